@@ -2,13 +2,18 @@
 
 #include "addfft.hh"
 #include <click/args.hh>
+#include <click/bitvector.hh>
 #include <click/error.hh>
+#include <click/standard/scheduleinfo.hh>
+#include <click/straccum.hh>
 
 #include "packet_info.hh"
 CLICK_DECLS
 
 AddFFT::AddFFT() :
-    _table(NULL), _port(0), _verbose(false), _down_timer(this)
+    _table(NULL), _port(0), _verbose(false), _down_timer(this),
+    _new_flow_rate(0), _new_flow_burst(0), _rejected(0), _deferred(0), _group(true),
+    _queue(false), _queue_size(1024), _queue_burst(256), _task(this), _coalesced(0)
 {
 }
 
@@ -23,29 +28,151 @@ AddFFT::configure(Vector<String> &conf, ErrorHandler *errh)
         .read_mp("TABLE", ElementCastArg("FFT"), _table)
         .read_mp("PORT", _port)
         .read("VERBOSE", _verbose)
+        .read("NEW_FLOW_RATE", _new_flow_rate)
+        .read("NEW_FLOW_BURST", _new_flow_burst)
+        .read("GROUP", _group)
+        .read("QUEUE", _queue)
+        .read("QUEUE_SIZE", _queue_size)
+        .read("QUEUE_BURST", _queue_burst)
         .complete() < 0)
         return -1;
 
+    if (_queue_size < 1 || _queue_size > (1U << 20))
+        return errh->error("QUEUE_SIZE must be between 1 and 1048576");
+    if (!_queue_burst)
+        return errh->error("QUEUE_BURST must be positive");
+
+    if (_new_flow_rate)
+    {
+        _new_flow_bucket.assign(_new_flow_rate, _new_flow_burst ? _new_flow_burst : _new_flow_rate);
+        _new_flow_bucket.set_full();
+    }
+
+    // With QUEUE, the packet path only reads configuration of the table
+    if (!_queue)
+        _table->add_user(this);
     return 0;
 }
 
 int
-AddFFT::initialize(ErrorHandler *)
+AddFFT::initialize(ErrorHandler *errh)
 {
     _down = false;
     _down_timer.initialize(this);
 
+    if (_queue)
+    {
+        // Queue size is rounded up to a power of two
+        uint32_t size = 1;
+        while (size < _queue_size)
+            size <<= 1;
+        _queue_size = size;
+
+        for (unsigned i = 0; i < _queues.weight(); i++)
+        {
+            Queue &q = _queues.get_value(i);
+            q.records = (FFT::Insert *) CLICK_LALLOC(sizeof(FFT::Insert) * _queue_size);
+            if (!q.records)
+                return errh->error("cannot allocate queue");
+        }
+
+        _batch.reserve(_queue_burst);
+        _results.resize(_queue_burst);
+        ScheduleInfo::initialize_task(this, &_task, false, errh);
+
+        // The table is not synchronized, so the task writing it and all
+        // elements reading it on the packet path must share one thread
+        int thread = _task.home_thread_id();
+        const Vector<Element *> &users = _table->users();
+        for (int i = 0; i < users.size(); i++)
+        {
+            Bitvector threads = users[i]->get_passing_threads();
+            for (int t = 0; t < threads.size(); t++)
+                if (threads[t] && t != thread)
+                    return errh->error("QUEUE requires %s to run in thread %d of the task, "
+                                       "it runs in thread %d", users[i]->name().c_str(), thread, t);
+        }
+    }
+
     return 0;
 }
 
+// Insertions left in the queues are dropped
+void
+AddFFT::cleanup(CleanupStage)
+{
+    for (unsigned i = 0; i < _queues.weight(); i++)
+    {
+        Queue &q = _queues.get_value(i);
+        if (q.records)
+            CLICK_LFREE(q.records, sizeof(FFT::Insert) * _queue_size);
+        q.records = NULL;
+    }
+}
+
+inline void
+AddFFT::count_result(int ret)
+{
+    if (ret == -2)
+        _rejected++;
+    else if (ret == -3)
+        _deferred++;
+}
+
+// Only the key and routing information are copied on the packet path, the
+// table is written only by the task. If the queue of this thread is full,
+// the insertion is dropped: next packets of the flow miss the FFT and are
+// queued again.
+inline bool
+AddFFT::enqueue(const FFT::PacketRun &run)
+{
+    Queue &q = *_queues;
+    uint32_t head = q.head;
+
+    if (head - __atomic_load_n(&q.tail, __ATOMIC_ACQUIRE) >= _queue_size)
+    {
+        q.full++;
+        return false;
+    }
+
+    _table->make_insert(run, _port, q.records[head & (_queue_size - 1)]);
+    __atomic_store_n(&q.head, head + 1, __ATOMIC_RELEASE);
+    q.queued++;
+
+    if (!_task.scheduled())
+        _task.reschedule();
+
+    return true;
+}
+
+inline void
+AddFFT::add_flow(const FFT::PacketRun &run)
+{
+    if (_queue)
+    {
+        bool queued = enqueue(run);
+        if (_verbose)
+            click_chatter("AddFFT: %s packets: %u port: %u %s", packet_info(run.first).c_str(),
+                          run.count, _port, queued ? "queued" : "dropped, queue full");
+        return;
+    }
+
+    int ret = _table->add_flow(run, _port, _new_flow_rate ? &_new_flow_bucket : NULL);
+
+    count_result(ret);
+
+    if (_verbose)
+        click_chatter("AddFFT: %s packets: %u port: %u%s", packet_info(run.first).c_str(),
+                      run.count, _port, ret == -2 ? " rejected" : (ret == -3 ? " deferred" : ""));
+}
+
 Packet*
 AddFFT::simple_action(Packet *p)
 {
     if (!_down)
     {
-        _table->add_flow(p, _port);
-        if (_verbose)
-            click_chatter("AddFFT: %s port: %u", packet_info(p).c_str(), _port);
+        FFT::PacketRun run = { p, p, 1, p->length() };
+        add_flow(run);
     }
 
     return p;
@@ -57,16 +184,90 @@ AddFFT::simple_action_batch(PacketBatch* batch)
 {
     if (!_down)
     {
-        FOR_EACH_PACKET(batch, p) {
-            _table->add_flow(p, _port);
-            if (_verbose)
-                click_chatter("AddFFT: %s port: %u", packet_info(p).c_str(), _port);
+        if (_group)
+            _table->for_each_run(batch, [this](const FFT::PacketRun &run) { add_flow(run); });
+        else
+        {
+            FOR_EACH_PACKET(batch, p) {
+                FFT::PacketRun run = { p, p, 1, p->length() };
+                add_flow(run);
+            }
         }
     }
     return batch;
 }
 #endif
 
+// Moves insertions from the queue to the batch, up to QUEUE_BURST in total.
+// Insertion of a flow already in the batch replaces the queued one, packets
+// and bytes of both are accounted. Returns the number of insertions left in
+// the queue.
+inline int
+AddFFT::drain(Queue &q)
+{
+    uint32_t tail = q.tail;
+    uint32_t head = __atomic_load_n(&q.head, __ATOMIC_ACQUIRE);
+
+    for (; tail != head && (uint32_t) _batch.size() < _queue_burst; tail++)
+    {
+        const FFT::Insert &ins = q.records[tail & (_queue_size - 1)];
+        int *i = _pending.get_pointer(InsertKey(ins));
+
+        if (!i)
+        {
+            _pending.set(InsertKey(ins), _batch.size());
+            _batch.push_back(ins);
+            continue;
+        }
+
+        FFT::Insert &prev = _batch[*i];
+        uint32_t count = prev.count + ins.count;
+        uint64_t bytes = prev.bytes + ins.bytes;
+#if FFT_DETAILED_STATS
+        Timestamp first = prev.first;
+#endif
+        prev = ins;
+        prev.count = count;
+        prev.bytes = bytes;
+#if FFT_DETAILED_STATS
+        prev.first = first;
+#endif
+        _coalesced++;
+    }
+
+    __atomic_store_n(&q.tail, tail, __ATOMIC_RELEASE);
+    return head - tail;
+}
+
+// Queues of all threads are drained and the batch is applied at once. Task
+// is rescheduled until the queues are empty, so insertions become visible
+// within a few rounds of the scheduler.
+bool
+AddFFT::run_task(Task *)
+{
+    int left = 0;
+
+    _batch.clear();
+    _pending.clear();
+
+    for (unsigned i = 0; i < _queues.weight(); i++)
+        left += drain(_queues.get_value(i));
+
+    // Flows queued before the port went down are not added
+    if (_batch.size() && !_down)
+    {
+        _table->add_flows(_batch.begin(), _batch.size(),
+                          _new_flow_rate ? &_new_flow_bucket : NULL, _results.begin());
+        for (int i = 0; i < _batch.size(); i++)
+            count_result(_results[i]);
+    }
+
+    if (left)
+        _task.fast_reschedule();
+
+    return _batch.size() > 0;
+}
+
 void
 AddFFT::set_down()
 {
@@ -92,7 +293,54 @@ AddFFT::run_timer(Timer *timer)
     _down = false;
 }
 
-enum { H_DOWN, H_UP };
+// Numbers of queued insertions and of insertions dropped because the queue
+// was full, in total and for each thread (with the current queue length),
+// then the number of coalesced insertions
+String
+AddFFT::unparse_queue_stats()
+{
+    StringAccum sa;
+    uint64_t queued = 0, full = 0;
+
+    for (unsigned i = 0; i < _queues.weight(); i++)
+    {
+        queued += _queues.get_value(i).queued;
+        full += _queues.get_value(i).full;
+    }
+
+    sa << "queued " << queued << '\n'
+       << "full " << full << '\n';
+
+    for (unsigned i = 0; i < _queues.weight(); i++)
+    {
+        const Queue &q = _queues.get_value(i);
+        if (q.queued || q.full)
+            sa << "thread " << i << ' ' << q.queued << ' ' << q.full << ' '
+               << (q.head - q.tail) << '\n';
+    }
+
+    sa << "coalesced " << _coalesced << '\n';
+    return sa.take_string();
+}
+
+enum { H_DOWN, H_UP, H_REJECTED, H_DEFERRED, H_QUEUE_STATS };
+
+String
+AddFFT::read_handler(Element *e, void *thunk)
+{
+    AddFFT *addfft = (AddFFT *) e;
+    switch ((intptr_t) thunk)
+    {
+        case H_REJECTED:
+            return String(addfft->_rejected);
+        case H_DEFERRED:
+            return String(addfft->_deferred);
+        case H_QUEUE_STATS:
+            return addfft->unparse_queue_stats();
+        default:
+            return "<error>";
+    }
+}
 
 int
 AddFFT::write_handler(const String &, Element *e, void *thunk, ErrorHandler *)
@@ -120,6 +368,13 @@ AddFFT::add_handlers()
 {
     add_write_handler("down", write_handler, H_DOWN, Handler::BUTTON);
     add_write_handler("up", write_handler, H_UP, Handler::BUTTON);
+    add_read_handler("rejected", read_handler, H_REJECTED);
+    add_read_handler("deferred", read_handler, H_DEFERRED);
+    if (_queue)
+    {
+        add_read_handler("queue_stats", read_handler, H_QUEUE_STATS);
+        add_task_handlers(&_task);
+    }
 }
 
 CLICK_ENDDECLS
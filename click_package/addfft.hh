@@ -1,6 +1,9 @@
 #ifndef ADDFFT_HH
 #define ADDFFT_HH
 #include <click/batchelement.hh>
+#include <click/hashtable.hh>
+#include <click/multithread.hh>
+#include <click/task.hh>
 #include <click/timer.hh>
 #include "fft.hh"
 CLICK_DECLS
@@ -18,6 +21,7 @@ class AddFFT : public BatchElement
 
         int configure(Vector<String> &conf, ErrorHandler *);
         int initialize(ErrorHandler *);
+        void cleanup(CleanupStage);
         void add_handlers();
 
         Packet *simple_action(Packet *);
@@ -26,17 +30,81 @@ class AddFFT : public BatchElement
     #endif
 
         void run_timer(Timer *timer);
+        bool run_task(Task *);
 
         void set_down();
         void set_up();
 
     private:
 
+        // Insertions queued by one thread and applied by the task. There is
+        // a single producer and a single consumer, indices wrap around.
+        struct Queue
+        {
+            FFT::Insert *records;
+            volatile uint32_t head;
+            volatile uint32_t tail;
+            uint64_t queued;
+            uint64_t full;
+
+            Queue() : records(NULL), head(0), tail(0), queued(0), full(0) {}
+        };
+
+        // Queued insertions of the same flow and direction are coalesced
+        struct InsertKey
+        {
+            uint32_t src_addr;
+            uint32_t dst_addr;
+            uint16_t src_port;
+            uint16_t dst_port;
+            uint32_t hash;
+            uint8_t dir;
+
+            InsertKey() : src_addr(0), dst_addr(0), src_port(0), dst_port(0), hash(0), dir(0) {}
+
+            InsertKey(const FFT::Insert &ins) :
+                src_addr(ins.src_addr), dst_addr(ins.dst_addr), src_port(ins.src_port),
+                dst_port(ins.dst_port), hash(ins.hash), dir(ins.dir) {}
+
+            inline hashcode_t hashcode() const { return hash; }
+
+            inline bool
+            operator==(const InsertKey &b) const
+            {
+                return src_addr == b.src_addr && dst_addr == b.dst_addr && src_port == b.src_port
+                    && dst_port == b.dst_port && hash == b.hash && dir == b.dir;
+            }
+        };
+
         FFT *_table;
         uint8_t _port;
         bool _verbose;
         Timer _down_timer;
         bool _down;
+        uint32_t _new_flow_rate;
+        uint32_t _new_flow_burst;
+        TokenBucket _new_flow_bucket;
+        uint64_t _rejected;
+        uint64_t _deferred;
+        bool _group;
+
+        bool _queue;
+        uint32_t _queue_size;
+        uint32_t _queue_burst;
+        per_thread<Queue> _queues;
+        Task _task;
+        Vector<FFT::Insert> _batch;
+        Vector<int> _results;
+        HashTable<InsertKey, int> _pending;
+        uint64_t _coalesced;
+
+        inline void add_flow(const FFT::PacketRun &);
+        inline bool enqueue(const FFT::PacketRun &);
+        inline void count_result(int);
+        inline int drain(Queue &);
+        String unparse_queue_stats();
+
+        static String read_handler(Element *, void *);
 
         static int write_handler(const String &, Element *, void *, ErrorHandler *);
 };
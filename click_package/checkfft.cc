@@ -8,7 +8,7 @@
 CLICK_DECLS
 
 CheckFFT::CheckFFT() :
-    _table(NULL), _verbose(false)
+    _table(NULL), _verbose(false), _group(true)
 {
 }
 
@@ -22,9 +22,11 @@ CheckFFT::configure(Vector<String> &conf, ErrorHandler *errh)
     if (Args(conf, this, errh)
         .read_mp("TABLE", ElementCastArg("FFT"), _table)
         .read("VERBOSE", _verbose)
+        .read("GROUP", _group)
         .complete() < 0)
         return -1;
 
+    _table->add_user(this);
     return 0;
 }
 
@@ -49,6 +51,18 @@ CheckFFT::process(Packet *p)
         return 0;
 }
 
+inline int
+CheckFFT::process(const FFT::PacketRun &run)
+{
+    int present_on_fft = _table->check_flow(run);
+
+    if (_verbose)
+        click_chatter("CheckFFT: %s packets: %u result: %u", packet_info(run.first).c_str(),
+                      run.count, present_on_fft);
+
+    return present_on_fft ? 1 : 0;
+}
+
 void
 CheckFFT::push(int, Packet *p)
 {
@@ -59,7 +73,12 @@ CheckFFT::push(int, Packet *p)
 void
 CheckFFT::push_batch(int, PacketBatch *batch)
 {
-    CLASSIFY_EACH_PACKET(2, process, batch, output_push_batch);
+    if (_group)
+        _table->classify_runs(batch, 2,
+                              [this](const FFT::PacketRun &run) { return process(run); },
+                              [this](int port, PacketBatch *b) { output_push_batch(port, b); });
+    else
+        CLASSIFY_EACH_PACKET(2, process, batch, output_push_batch);
 }
 #endif
 
@@ -27,7 +27,9 @@ class CheckFFT : public BatchElement
 
         FFT *_table;
         bool _verbose;
+        bool _group;
         inline int process(Packet *);
+        inline int process(const FFT::PacketRun &);
 };
 
 CLICK_ENDDECLS
@@ -0,0 +1,230 @@
+#include <click/config.h>
+
+#include "counterpage.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+CLICK_DECLS
+
+CounterPage::CounterPage() :
+    _table(NULL), _interval(10), _base(NULL), _length(0), _header(NULL), _slots(NULL),
+    _timer(this)
+{
+}
+
+CounterPage::~CounterPage()
+{
+}
+
+int
+CounterPage::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    String labels;
+
+    if (Args(conf, this, errh)
+        .read_mp("NAME", StringArg(), _name)
+        .read("LABELS", AnyArg(), labels)
+        .read("TABLE", ElementCastArg("FFT"), _table)
+        .read("INTERVAL", SecondsArg(3), _interval)
+        .complete() < 0)
+        return -1;
+
+    if (_table && !_interval)
+        return errh->error("INTERVAL must be positive");
+
+    if (!_name || (_name[0] == '/' && _name.length() == 1))
+        return errh->error("NAME must not be empty");
+    if (_name[0] != '/')
+        _name = "/" + _name;
+
+    // Ports are labeled by their numbers by default
+    cp_spacevec(cp_unquote(labels), _labels);
+    if (!_labels.size())
+        for (int i = 0; i < ninputs(); i++)
+            _labels.push_back(String(i));
+    if (_labels.size() != ninputs())
+        return errh->error("%d LABELS given for %d ports", _labels.size(), ninputs());
+    for (int i = 0; i < _labels.size(); i++)
+        if (_labels[i].length() >= LABEL_SIZE)
+            return errh->error("label '%s' is too long", _labels[i].c_str());
+
+    return 0;
+}
+
+// Existing page is reused and reset, so monitors find it under the same
+// name after the router is restarted. Magic is written last, so readers
+// can check that the page is initialized.
+int
+CounterPage::initialize(ErrorHandler *errh)
+{
+    unsigned nthreads = _thread_slots.weight();
+
+    _length = sizeof(Header) + nthreads * ninputs() * sizeof(Slot);
+
+    int fd = shm_open(_name.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return errh->error("shm_open %s: %s", _name.c_str(), strerror(errno));
+
+    if (ftruncate(fd, _length) < 0)
+    {
+        errh->error("ftruncate %s: %s", _name.c_str(), strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    _base = mmap(NULL, _length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (_base == MAP_FAILED)
+    {
+        _base = NULL;
+        return errh->error("mmap %s: %s", _name.c_str(), strerror(errno));
+    }
+
+    _header = (Header *) _base;
+    _slots = (Slot *) (_header + 1);
+
+    _header->magic = 0;
+    __sync_synchronize();
+    memset((char *) _base + sizeof(uint32_t), 0, _length - sizeof(uint32_t));
+    _header->version = VERSION;
+    _header->nports = ninputs();
+    _header->interval = _table ? _interval : 0;
+    _header->nthreads = nthreads;
+    for (unsigned t = 0; t < nthreads; t++)
+    {
+        _thread_slots.get_value(t) = _slots + t * ninputs();
+        for (int i = 0; i < ninputs(); i++)
+            memcpy(_slots[t * ninputs() + i].label, _labels[i].data(), _labels[i].length());
+    }
+    __sync_synchronize();
+    _header->magic = MAGIC;
+
+    if (_table)
+    {
+        _timer.initialize(this);
+        _timer.schedule_now();
+    }
+
+    return 0;
+}
+
+void
+CounterPage::cleanup(CleanupStage)
+{
+    // The object is not unlinked, monitors may still read the last values
+    if (_base)
+        munmap(_base, _length);
+    _base = NULL;
+    _header = NULL;
+    _slots = NULL;
+}
+
+// Each sequence number has a single writer, so it is advanced with plain
+// stores, the release fences order them around the counter updates
+inline void
+CounterPage::write_begin(volatile uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+inline void
+CounterPage::write_end(volatile uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+// Packets are counted in the slot of the current thread
+inline void
+CounterPage::count(int port, uint32_t packets, uint64_t bytes)
+{
+    Slot &s = (*_thread_slots)[port];
+
+    write_begin(&s.seq);
+    s.packets += packets;
+    s.bytes += bytes;
+    write_end(&s.seq);
+}
+
+void
+CounterPage::run_timer(Timer *)
+{
+    write_begin(&_header->seq);
+    _header->fft_size = _table->size();
+    write_end(&_header->seq);
+
+    _timer.reschedule_after_msec(_interval);
+}
+
+void
+CounterPage::push(int port, Packet *p)
+{
+    count(port, 1, p->length());
+    output(port).push(p);
+}
+
+#if HAVE_BATCH
+// Page is written once per batch
+void
+CounterPage::push_batch(int port, PacketBatch *batch)
+{
+    uint64_t bytes = 0;
+
+    FOR_EACH_PACKET(batch, p)
+        bytes += p->length();
+
+    count(port, batch->count(), bytes);
+    output_push_batch(port, batch);
+}
+#endif
+
+enum { H_COUNTS, H_FFT_SIZE };
+
+String
+CounterPage::read_handler(Element *e, void *thunk)
+{
+    CounterPage *cp = (CounterPage *) e;
+
+    if (!cp->_header)
+        return String();
+
+    switch ((intptr_t) thunk)
+    {
+        case H_COUNTS:
+        {
+            // One line per port: label, packets and bytes of all threads
+            StringAccum sa;
+            for (int i = 0; i < cp->_labels.size(); i++)
+            {
+                uint64_t packets = 0, bytes = 0;
+                for (unsigned t = 0; t < cp->_header->nthreads; t++)
+                {
+                    packets += cp->_slots[t * cp->_labels.size() + i].packets;
+                    bytes += cp->_slots[t * cp->_labels.size() + i].bytes;
+                }
+                sa << cp->_labels[i] << ' ' << packets << ' ' << bytes << '\n';
+            }
+            return sa.take_string();
+        }
+        case H_FFT_SIZE:
+            return String(cp->_header->fft_size);
+        default:
+            return "<error>";
+    }
+}
+
+void
+CounterPage::add_handlers()
+{
+    add_read_handler("counts", read_handler, H_COUNTS);
+    add_read_handler("fft_size", read_handler, H_FFT_SIZE);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel)
+EXPORT_ELEMENT(CounterPage)
@@ -0,0 +1,85 @@
+#ifndef COUNTERPAGE_HH
+#define COUNTERPAGE_HH
+#include <click/batchelement.hh>
+#include <click/multithread.hh>
+#include <click/timer.hh>
+#include "fft.hh"
+CLICK_DECLS
+
+class CounterPage : public BatchElement
+{
+    public:
+
+        CounterPage();
+        ~CounterPage();
+
+        const char *class_name() const { return "CounterPage"; }
+        const char *port_count() const { return "1-/="; }
+        const char *processing() const { return PUSH; }
+
+        int configure(Vector<String> &conf, ErrorHandler *);
+        int initialize(ErrorHandler *);
+        void cleanup(CleanupStage);
+        void add_handlers();
+
+        void run_timer(Timer *);
+
+        void push(int, Packet *);
+    #if HAVE_BATCH
+        void push_batch (int, PacketBatch *);
+    #endif
+
+    private:
+
+        enum { MAGIC = 0x46434E54, VERSION = 2, LABEL_SIZE = 16 };
+
+        // Page in named shared memory: header followed by one block of
+        // slots per thread, with one slot per port, each on its own cache
+        // line. Every slot has a single writer, its thread, and the header
+        // is written only by the timer, so they are protected by their own
+        // seqlock without atomic operations: 'seq' is odd while the slot is
+        // written, readers retry if it was odd or changed during the read.
+        // Fields are in host byte order.
+        struct Header
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t nports;
+            uint32_t interval;
+            volatile uint32_t seq;
+            uint32_t nthreads;
+            uint64_t fft_size;
+            uint8_t pad2[32];
+        };
+
+        struct Slot
+        {
+            volatile uint32_t seq;
+            uint32_t pad;
+            uint64_t packets;
+            uint64_t bytes;
+            char label[LABEL_SIZE];
+            uint8_t pad2[24];
+        };
+
+        String _name;
+        Vector<String> _labels;
+        FFT *_table;
+        uint32_t _interval;
+
+        void *_base;
+        size_t _length;
+        Header *_header;
+        Slot *_slots;
+        per_thread<Slot *> _thread_slots;
+        Timer _timer;
+
+        static inline void write_begin(volatile uint32_t *seq);
+        static inline void write_end(volatile uint32_t *seq);
+        inline void count(int port, uint32_t packets, uint64_t bytes);
+
+        static String read_handler(Element *, void *);
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,163 @@
+#include <click/config.h>
+
+#include "demuxfft.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/packet_anno.hh>
+
+#include "packet_info.hh"
+#include "my_set_ip.hh"
+CLICK_DECLS
+
+DemuxFFT::DemuxFFT() :
+    _table(NULL), _paint(-1), _verbose(false), _hits(0), _misses(0)
+{
+}
+
+DemuxFFT::~DemuxFFT()
+{
+}
+
+int
+DemuxFFT::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    if (Args(conf, this, errh)
+        .read_mp("TABLE", ElementCastArg("FFT"), _table)
+        .read("PAINT", _paint)
+        .read("VERBOSE", _verbose)
+        .complete() < 0)
+        return -1;
+
+    if (_paint > 255)
+        return errh->error("PAINT must be between 0 and 255");
+
+    _table->add_user(this);
+    return 0;
+}
+
+int
+DemuxFFT::initialize(ErrorHandler *)
+{
+    return 0;
+}
+
+// Sets IP header annotation for Ethernet frame carrying IPv4 packet and returns
+// the length of link layer header. Header and total lengths are checked as in
+// CheckIPHeader, so malformed packets take the slow path, but checksum is not
+// verified.
+inline int
+DemuxFFT::parse_headers(Packet *p)
+{
+    const uint8_t *data = p->data();
+    const uint8_t *end_data = p->end_data();
+    const click_ether *ethh = reinterpret_cast<const click_ether *>(data);
+    const click_ip *iph;
+
+    if (data + sizeof(click_ether) > end_data)
+        return -1;
+
+    if (UNALIGNED_NET_SHORT_EQ(ethh->ether_type, ETHERTYPE_IP))
+        iph = reinterpret_cast<const click_ip *>(ethh + 1);
+    else if (UNALIGNED_NET_SHORT_EQ(ethh->ether_type, ETHERTYPE_8021Q)
+             && data + sizeof(click_ether_vlan) <= end_data)
+    {
+        const click_ether_vlan *ethvh = reinterpret_cast<const click_ether_vlan *>(ethh);
+        if (!UNALIGNED_NET_SHORT_EQ(ethvh->ether_vlan_encap_proto, ETHERTYPE_IP))
+            return -1;
+        iph = reinterpret_cast<const click_ip *>(ethvh + 1);
+    }
+    else
+        return -1;
+
+    const uint8_t *ip = reinterpret_cast<const uint8_t *>(iph);
+
+    if (ip + sizeof(click_ip) > end_data || iph->ip_v != 4 || iph->ip_hl < 5)
+        return -1;
+
+    unsigned hlen = iph->ip_hl << 2;
+    unsigned len = ntohs(iph->ip_len);
+
+    if (len < hlen || ip + len > end_data)
+        return -1;
+
+    // Ports are read from transport header by FFT
+    if (IP_FIRSTFRAG(iph) && (iph->ip_p == IP_PROTO_TCP || iph->ip_p == IP_PROTO_UDP)
+        && len < hlen + 4)
+        return -1;
+
+    p->set_ip_header(iph, hlen);
+    p->set_dst_ip_anno(iph->ip_dst);
+
+    return ip - data;
+}
+
+inline int
+DemuxFFT::process(Packet *p)
+{
+    int offset = parse_headers(p);
+    int port = -1;
+
+    if (offset >= 0)
+        port = _table->check_route_flow(p);
+
+    if (_verbose)
+        click_chatter("DemuxFFT: %s port: %d", offset >= 0 ? packet_info(p).c_str() : "non-IP", port);
+
+    if (port < 0 || port + 1 >= noutputs())
+    {
+        _misses++;
+        return 0;
+    }
+
+    // Hit, packet leaves in the same form as after Strip and CheckIPHeader,
+    // with link layer padding beyond the IP total length removed
+    p->pull(offset);
+    if (p->length() > ntohs(p->ip_header()->ip_len))
+        p->take(p->length() - ntohs(p->ip_header()->ip_len));
+    if (_paint >= 0)
+        SET_PAINT_ANNO(p, _paint);
+
+    _hits++;
+    return port + 1;
+}
+
+void
+DemuxFFT::push(int, Packet *p)
+{
+    output(process(p)).push(p);
+}
+
+#if HAVE_BATCH
+void
+DemuxFFT::push_batch(int, PacketBatch *batch)
+{
+    CLASSIFY_EACH_PACKET(noutputs(), process, batch, output_push_batch);
+}
+#endif
+
+enum { H_HITS, H_MISSES };
+
+String
+DemuxFFT::read_handler(Element *e, void *thunk)
+{
+    DemuxFFT *demuxfft = (DemuxFFT *) e;
+    switch ((intptr_t) thunk)
+    {
+        case H_HITS:
+            return String(demuxfft->_hits);
+        case H_MISSES:
+            return String(demuxfft->_misses);
+        default:
+            return "<error>";
+    }
+}
+
+void
+DemuxFFT::add_handlers()
+{
+    add_read_handler("hits", read_handler, H_HITS);
+    add_read_handler("misses", read_handler, H_MISSES);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(DemuxFFT)
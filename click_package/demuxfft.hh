@@ -0,0 +1,42 @@
+#ifndef DEMUXFFT_HH
+#define DEMUXFFT_HH
+#include <click/batchelement.hh>
+#include "fft.hh"
+CLICK_DECLS
+
+class DemuxFFT : public BatchElement
+{
+    public:
+
+        DemuxFFT();
+        ~DemuxFFT();
+
+        const char *class_name() const { return "DemuxFFT"; }
+        const char *port_count() const { return "1/2-"; }
+        const char *processing() const { return PUSH; }
+
+        int configure(Vector<String> &conf, ErrorHandler *);
+        int initialize(ErrorHandler *);
+        void add_handlers();
+
+        void push(int, Packet *);
+    #if HAVE_BATCH
+        void push_batch (int, PacketBatch *);
+    #endif
+
+    private:
+
+        FFT *_table;
+        int _paint;
+        bool _verbose;
+        uint64_t _hits;
+        uint64_t _misses;
+
+        inline int parse_headers(Packet *);
+        inline int process(Packet *);
+
+        static String read_handler(Element *, void *);
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,414 @@
+#include <click/config.h>
+
+#include "dir248iplookup.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+
+#include "packet_info.hh"
+CLICK_DECLS
+
+DIR248IPLookup::DIR248IPLookup() :
+    _tbl24(NULL), _len24(NULL), _tbl8(NULL), _len8(NULL),
+    _tbl8_groups(1024), _fft(NULL), _no_route_printed(false)
+{
+}
+
+DIR248IPLookup::~DIR248IPLookup()
+{
+}
+
+int
+DIR248IPLookup::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    if (Args(this, errh).bind(conf)
+        .read("TBL8_GROUPS", _tbl8_groups)
+        .read("FFT", ElementCastArg("FFT"), _fft)
+        .consume() < 0)
+        return -1;
+
+    if (_tbl8_groups == 0 || _tbl8_groups > MAX_TBL8_GROUPS)
+        return errh->error("TBL8_GROUPS must be between 1 and %d", MAX_TBL8_GROUPS);
+
+    _tbl24 = (uint16_t *) CLICK_LALLOC(sizeof(uint16_t) * TBL24_SIZE);
+    _len24 = (uint8_t *) CLICK_LALLOC(sizeof(uint8_t) * TBL24_SIZE);
+    _tbl8 = (uint16_t *) CLICK_LALLOC(sizeof(uint16_t) * TBL8_GROUP_SIZE * _tbl8_groups);
+    _len8 = (uint8_t *) CLICK_LALLOC(sizeof(uint8_t) * TBL8_GROUP_SIZE * _tbl8_groups);
+
+    if (!_tbl24 || !_len24 || !_tbl8 || !_len8)
+        return errh->error("out of memory");
+
+    memset(_tbl24, 0, sizeof(uint16_t) * TBL24_SIZE);
+    memset(_len24, 0, sizeof(uint8_t) * TBL24_SIZE);
+
+    for (int g = _tbl8_groups - 1; g >= 0; g--)
+        _free_groups.push_back(g);
+
+    // Next hop 0 is reserved for "no route"
+    NextHop none;
+    none.port = -1;
+    none.refs = 1;
+    _nexthops.push_back(none);
+
+    return IPRouteTable::configure(conf, errh);
+}
+
+void
+DIR248IPLookup::cleanup(CleanupStage)
+{
+    if (_tbl24)
+        CLICK_LFREE(_tbl24, sizeof(uint16_t) * TBL24_SIZE);
+    if (_len24)
+        CLICK_LFREE(_len24, sizeof(uint8_t) * TBL24_SIZE);
+    if (_tbl8)
+        CLICK_LFREE(_tbl8, sizeof(uint16_t) * TBL8_GROUP_SIZE * _tbl8_groups);
+    if (_len8)
+        CLICK_LFREE(_len8, sizeof(uint8_t) * TBL8_GROUP_SIZE * _tbl8_groups);
+
+    _tbl24 = NULL;
+    _len24 = NULL;
+    _tbl8 = NULL;
+    _len8 = NULL;
+}
+
+int
+DIR248IPLookup::get_nexthop(IPAddress gw, int32_t port)
+{
+    for (int i = 1; i < _nexthops.size(); i++)
+        if (_nexthops[i].refs && _nexthops[i].gw == gw && _nexthops[i].port == port)
+        {
+            _nexthops[i].refs++;
+            return i;
+        }
+
+    int nh;
+
+    if (_free_nexthops.size())
+    {
+        nh = _free_nexthops.back();
+        _free_nexthops.pop_back();
+    }
+    else if (_nexthops.size() < MAX_NEXTHOPS)
+    {
+        nh = _nexthops.size();
+        _nexthops.push_back(NextHop());
+    }
+    else
+        return -1;
+
+    _nexthops[nh].gw = gw;
+    _nexthops[nh].port = port;
+    _nexthops[nh].refs = 1;
+    return nh;
+}
+
+void
+DIR248IPLookup::put_nexthop(uint16_t nh)
+{
+    if (nh && --_nexthops[nh].refs == 0)
+        _free_nexthops.push_back(nh);
+}
+
+bool
+DIR248IPLookup::find_covering(uint32_t addr, int len, uint16_t &nh, uint8_t &nh_len) const
+{
+    for (int l = len - 1; l >= 0; l--)
+    {
+        IPAddress prefix(htonl(l ? addr & (0xFFFFFFFFU << (32 - l)) : 0));
+        const IPRoute *r = _prefixes[l].get_pointer(prefix);
+        if (r)
+        {
+            nh = r->extra;
+            nh_len = l;
+            return true;
+        }
+    }
+
+    nh = 0;
+    nh_len = 0;
+    return false;
+}
+
+inline void
+DIR248IPLookup::add_changed(Vector<Range> &changed, uint32_t first, uint32_t last)
+{
+    if (changed.size() && changed.back().last + 1 == first)
+        changed.back().last = last;
+    else
+    {
+        Range r = { first, last };
+        changed.push_back(r);
+    }
+}
+
+// Writes next hop nh with length nh_len to all entries covered by addr/len.
+// When adding a route (only_equal false), entries written by more specific
+// routes are preserved. When removing a route (only_equal true), only entries
+// written by the removed route, so with length equal to len, are replaced.
+// Addresses of entries whose next hop changed are appended to 'changed'.
+void
+DIR248IPLookup::set_range(uint32_t addr, int len, uint16_t nh, uint8_t nh_len, bool only_equal,
+                          Vector<Range> &changed)
+{
+    if (len <= 24)
+    {
+        uint32_t start = addr >> 8;
+        uint32_t end = start + (1U << (24 - len));
+
+        for (uint32_t i = start; i < end; i++)
+        {
+            if (_tbl24[i] & EXTENDED)
+            {
+                uint32_t base = (_tbl24[i] & ~EXTENDED) * TBL8_GROUP_SIZE;
+                for (uint32_t j = base; j < base + TBL8_GROUP_SIZE; j++)
+                    if (only_equal ? _len8[j] == len : _len8[j] <= len)
+                    {
+                        if (_tbl8[j] != nh)
+                            add_changed(changed, (i << 8) | (j - base), (i << 8) | (j - base));
+                        _tbl8[j] = nh;
+                        _len8[j] = nh_len;
+                    }
+            }
+            else if (only_equal ? _len24[i] == len : _len24[i] <= len)
+            {
+                if (_tbl24[i] != nh)
+                    add_changed(changed, i << 8, (i << 8) | 0xFF);
+                _tbl24[i] = nh;
+                _len24[i] = nh_len;
+            }
+        }
+    }
+    else
+    {
+        uint32_t base = (_tbl24[addr >> 8] & ~EXTENDED) * TBL8_GROUP_SIZE;
+        uint32_t start = base + (addr & 0xFF);
+        uint32_t end = start + (1U << (32 - len));
+
+        for (uint32_t j = start; j < end; j++)
+            if (only_equal ? _len8[j] == len : _len8[j] <= len)
+            {
+                if (_tbl8[j] != nh)
+                    add_changed(changed, (addr & ~0xFFU) | (j - base), (addr & ~0xFFU) | (j - base));
+                _tbl8[j] = nh;
+                _len8[j] = nh_len;
+            }
+    }
+}
+
+// Flows are removed from the FFT only in the ranges, where the route
+// changed, so more specific routes keep their flows pinned. Ranges are
+// sorted, as set_range() walks the addresses in order, and are removed in
+// a single pass over the FFT.
+void
+DIR248IPLookup::invalidate(const Vector<Range> &changed)
+{
+    if (_fft && changed.size())
+        _fft->remove_ranges(changed);
+}
+
+void
+DIR248IPLookup::collapse_group(uint32_t index24)
+{
+    uint16_t g = _tbl24[index24] & ~EXTENDED;
+    uint32_t base = g * TBL8_GROUP_SIZE;
+
+    // Entries written by routes not longer than /24 are all equal, because
+    // such routes cover the whole group
+    for (uint32_t j = base; j < base + TBL8_GROUP_SIZE; j++)
+        if (_len8[j] > 24)
+            return;
+
+    _tbl24[index24] = _tbl8[base];
+    _len24[index24] = _len8[base];
+    _free_groups.push_back(g);
+}
+
+int
+DIR248IPLookup::add_route(const IPRoute &route, bool allow_replace, IPRoute *replaced_route, ErrorHandler *errh)
+{
+    int len = route.prefix_len();
+    if (len < 0)
+        return errh->error("%s: bad prefix mask", route.unparse_addr().c_str());
+
+    uint32_t addr = ntohl(route.addr.addr() & route.mask.addr());
+    IPAddress prefix = route.addr & route.mask;
+
+    IPRoute *existing = _prefixes[len].get_pointer(prefix);
+    if (existing && !allow_replace)
+        return -EEXIST;
+
+    if (len > 24 && !(_tbl24[addr >> 8] & EXTENDED) && !_free_groups.size())
+        return errh->error("no free tbl8 groups, increase TBL8_GROUPS");
+
+    int nh = get_nexthop(route.gw, route.port);
+    if (nh < 0)
+        return errh->error("too many distinct next hops");
+
+    if (len > 24 && !(_tbl24[addr >> 8] & EXTENDED))
+    {
+        uint16_t g = _free_groups.back();
+        _free_groups.pop_back();
+
+        uint32_t i = addr >> 8;
+        uint32_t base = g * TBL8_GROUP_SIZE;
+        for (uint32_t j = base; j < base + TBL8_GROUP_SIZE; j++)
+        {
+            _tbl8[j] = _tbl24[i];
+            _len8[j] = _len24[i];
+        }
+        _tbl24[i] = g | EXTENDED;
+    }
+
+    Vector<Range> changed;
+    set_range(addr, len, nh, len, false, changed);
+
+    if (existing)
+    {
+        if (replaced_route)
+            *replaced_route = *existing;
+        put_nexthop(existing->extra);
+    }
+
+    IPRoute &r = _prefixes[len][prefix];
+    r = route;
+    r.addr = prefix;
+    r.extra = nh;
+
+    // Flows whose best route is now the added one are pinned again
+    invalidate(changed);
+
+    return 0;
+}
+
+int
+DIR248IPLookup::remove_route(const IPRoute &route, IPRoute *removed_route, ErrorHandler *errh)
+{
+    int len = route.prefix_len();
+    if (len < 0)
+        return errh->error("%s: bad prefix mask", route.unparse_addr().c_str());
+
+    uint32_t addr = ntohl(route.addr.addr() & route.mask.addr());
+    IPAddress prefix = route.addr & route.mask;
+
+    IPRoute key = route;
+    key.addr = prefix;
+
+    IPRoute *existing = _prefixes[len].get_pointer(prefix);
+    if (!existing || !key.match(*existing))
+        return -ENOENT;
+
+    uint16_t nh;
+    uint8_t nh_len;
+    find_covering(addr, len, nh, nh_len);
+
+    Vector<Range> changed;
+    set_range(addr, len, nh, nh_len, true, changed);
+
+    if (len > 24)
+        collapse_group(addr >> 8);
+
+    if (removed_route)
+        *removed_route = *existing;
+    put_nexthop(existing->extra);
+    _prefixes[len].erase(prefix);
+
+    invalidate(changed);
+
+    return 0;
+}
+
+String
+DIR248IPLookup::dump_routes()
+{
+    StringAccum sa;
+
+    for (int len = 0; len <= 32; len++)
+        for (auto it = _prefixes[len].begin(); it; it++)
+        {
+            IPRoute r = it.value();
+            r.unparse(sa, true) << '\n';
+        }
+
+    return sa.take_string();
+}
+
+inline int
+DIR248IPLookup::process(Packet *p)
+{
+    IPAddress gw;
+    int port = lookup_route(p->dst_ip_anno(), gw);
+
+    if (port >= 0)
+    {
+        if (gw)
+            p->set_dst_ip_anno(gw);
+        return port;
+    }
+    else
+    {
+        if (!_no_route_printed)
+        {
+            click_chatter("DIR248IPLookup: no route for packet: %s", packet_info(p).c_str());
+            _no_route_printed = true;
+        }
+        return noutputs();
+    }
+}
+
+void
+DIR248IPLookup::push(int, Packet *p)
+{
+    checked_output_push(process(p), p);
+}
+
+#if HAVE_BATCH
+void
+DIR248IPLookup::push_batch(int, PacketBatch *batch)
+{
+    // First pass issues prefetches of tbl24 entries for the whole batch,
+    // so the lookups in the second pass overlap their cache misses
+    FOR_EACH_PACKET(batch, p)
+        __builtin_prefetch(&_tbl24[ntohl(p->dst_ip_anno().addr()) >> 8], 0, 0);
+
+    CLASSIFY_EACH_PACKET(noutputs() + 1, process, batch, checked_output_push_batch);
+}
+#endif
+
+enum { H_ROUTES, H_NEXTHOPS, H_TBL8_GROUPS, H_TBL8_USED };
+
+String
+DIR248IPLookup::read_handler(Element *e, void *thunk)
+{
+    DIR248IPLookup *dl = (DIR248IPLookup *) e;
+    switch ((intptr_t) thunk)
+    {
+        case H_ROUTES:
+        {
+            int routes = 0;
+            for (int len = 0; len <= 32; len++)
+                routes += dl->_prefixes[len].size();
+            return String(routes);
+        }
+        case H_NEXTHOPS:
+            return String(dl->_nexthops.size() - 1 - dl->_free_nexthops.size());
+        case H_TBL8_GROUPS:
+            return String(dl->_tbl8_groups);
+        case H_TBL8_USED:
+            return String(dl->_tbl8_groups - dl->_free_groups.size());
+        default:
+            return "<error>";
+    }
+}
+
+void
+DIR248IPLookup::add_handlers()
+{
+    IPRouteTable::add_handlers();
+    add_read_handler("routes", read_handler, H_ROUTES);
+    add_read_handler("nexthops", read_handler, H_NEXTHOPS);
+    add_read_handler("tbl8_groups", read_handler, H_TBL8_GROUPS);
+    add_read_handler("tbl8_used", read_handler, H_TBL8_USED);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(DIR248IPLookup)
@@ -0,0 +1,105 @@
+#ifndef DIR248IPLOOKUP_HH
+#define DIR248IPLOOKUP_HH
+#include <click/hashtable.hh>
+#include "iproutetable.hh"
+#include "fft.hh"
+CLICK_DECLS
+
+class DIR248IPLookup : public IPRouteTable
+{
+    public:
+
+        DIR248IPLookup();
+        ~DIR248IPLookup();
+
+        const char *class_name() const { return "DIR248IPLookup"; }
+        const char *port_count() const { return "1/-"; }
+        const char *processing() const { return PUSH; }
+
+        int configure(Vector<String> &conf, ErrorHandler *);
+        void cleanup(CleanupStage);
+        void add_handlers();
+
+        int add_route(const IPRoute &route, bool allow_replace, IPRoute *replaced_route, ErrorHandler *errh);
+        int remove_route(const IPRoute &route, IPRoute *removed_route, ErrorHandler *errh);
+        int lookup_route(IPAddress addr, IPAddress &gw) const;
+        String dump_routes();
+
+        void push(int, Packet *);
+    #if HAVE_BATCH
+        void push_batch (int, PacketBatch *);
+    #endif
+
+    private:
+
+        enum
+        {
+            TBL24_SIZE = 1 << 24,
+            TBL8_GROUP_SIZE = 256,
+            EXTENDED = 0x8000,
+            MAX_TBL8_GROUPS = 0x8000,
+            MAX_NEXTHOPS = 0x8000
+        };
+
+        // Range of addresses, in which the next hop was changed by
+        // set_range()
+        typedef FFT::AddressRange Range;
+
+        struct NextHop
+        {
+            IPAddress gw;
+            int32_t port;
+            uint32_t refs;
+        };
+
+        // Entries in both tables are next hop indexes (0 means no route),
+        // or tbl8 group indexes with EXTENDED bit set (only in tbl24).
+        // Parallel length tables hold prefix length of the route, which
+        // has written the entry.
+        uint16_t *_tbl24;
+        uint8_t *_len24;
+        uint16_t *_tbl8;
+        uint8_t *_len8;
+        uint32_t _tbl8_groups;
+        Vector<uint16_t> _free_groups;
+
+        Vector<NextHop> _nexthops;
+        Vector<uint16_t> _free_nexthops;
+
+        HashTable<IPAddress, IPRoute> _prefixes[33];
+
+        FFT *_fft;
+        bool _no_route_printed;
+
+        int get_nexthop(IPAddress gw, int32_t port);
+        void put_nexthop(uint16_t nh);
+        bool find_covering(uint32_t addr, int len, uint16_t &nh, uint8_t &nh_len) const;
+        void set_range(uint32_t addr, int len, uint16_t nh, uint8_t nh_len, bool only_equal,
+                       Vector<Range> &changed);
+        static inline void add_changed(Vector<Range> &, uint32_t first, uint32_t last);
+        void invalidate(const Vector<Range> &);
+        void collapse_group(uint32_t index24);
+
+        inline int process(Packet *);
+
+        static String read_handler(Element *, void *);
+};
+
+inline int
+DIR248IPLookup::lookup_route(IPAddress addr, IPAddress &gw) const
+{
+    uint32_t a = ntohl(addr.addr());
+    uint16_t e = _tbl24[a >> 8];
+
+    if (e & EXTENDED)
+        e = _tbl8[((e & ~EXTENDED) << 8) | (a & 0xFF)];
+
+    if (!e)
+        return -1;
+
+    gw = _nexthops[e].gw;
+    return _nexthops[e].port;
+}
+
+CLICK_ENDDECLS
+#endif
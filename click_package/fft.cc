@@ -3,216 +3,1728 @@
 #include "fft.hh"
 #include <click/args.hh>
 #include <click/error.hh>
+#include <click/packet_anno.hh>
 CLICK_DECLS
 
+#if FFT_LATENCY_STATS
+# define FFT_LATENCY(op) LatencyScope latency_scope(this, op)
+#else
+# define FFT_LATENCY(op)
+#endif
+
 FFT::FFT() :
-    _timeout(0xFFFFFFFF), _loop_avoidance(true),
-    _gc_on_add(false), _gc_on_check(false)
+    _timeout(0xFFFFFFFF), _key_type(KEY_4TUPLE), _symmetric(false),
+    _loop_avoidance(true), _rss_udp(false),
+    _gc_on_add(false), _gc_on_check(false),
+    _timeout_min(1000), _timeout_max(0), _target_size(0), _adapt_interval(1000),
+    _inserted(0), _adapt_inserted(0), _history_pos(0), _adapt_timer(this),
+    _new_flow_rate(0), _new_flow_burst(0),
+    _admitted(0), _rejected_global(0), _rejected_local(0),
+    _doorkeeper_bits(0), _doorkeeper_period(1000), _doorkeeper_mask(0), _doorkeeper_cur(0),
+    _doorkeeper_start(0), _deferred(0), _repinned(0), _bulk_records(0), _bulk_applied(0),
+    _arena_prealloc(0), _arena_reserve(1024), _hugepages(true), _numa_node(-1),
+    _shm_size(1048576), _shm(NULL), _port_stats(false),
+    _hot_size(0), _hot_mask(0), _hot(NULL), _hot_mem(NULL), _hot_mem_size(0),
+    _hot_hits(0), _hot_misses(0), _index(false), _listener(NULL), _refresh_period(1000),
+    _latency_sample(1)
+{
+    _doorkeeper[0] = _doorkeeper[1] = NULL;
+}
+
+FFT::~FFT()
+{
+}
+
+int
+FFT::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    String hash_type = "jenkins";
+    String rss_key;
+    String key_type = "4tuple";
+
+    if (Args(conf, this, errh)
+        .read("TIMEOUT", SecondsArg(3), _timeout)
+        .read("KEY", WordArg(), key_type)
+        .read("SYMMETRIC", _symmetric)
+        .read("LOOP_AVOIDANCE", _loop_avoidance)
+        .read("GC_ON_ADD", _gc_on_add)
+        .read("GC_ON_CHECK", _gc_on_check)
+        .read("TARGET_SIZE", _target_size)
+        .read("TIMEOUT_MIN", SecondsArg(3), _timeout_min)
+        .read("TIMEOUT_MAX", SecondsArg(3), _timeout_max)
+        .read("ADAPT_INTERVAL", SecondsArg(3), _adapt_interval)
+        .read("HASH", WordArg(), hash_type)
+        .read("RSS_KEY", StringArg(), rss_key)
+        .read("RSS_UDP", _rss_udp)
+        .read("NEW_FLOW_RATE", _new_flow_rate)
+        .read("NEW_FLOW_BURST", _new_flow_burst)
+        .read("DOORKEEPER", _doorkeeper_bits)
+        .read("DOORKEEPER_PERIOD", SecondsArg(3), _doorkeeper_period)
+        .read("INDEX", _index)
+        .read("HOT_SIZE", _hot_size)
+        .read("PORT_STATS", _port_stats)
+        .read("LATENCY_SAMPLE", _latency_sample)
+        .read("ARENA_PREALLOC", _arena_prealloc)
+        .read("ARENA_RESERVE", _arena_reserve)
+        .read("HUGEPAGES", _hugepages)
+        .read("NUMA_NODE", _numa_node)
+        .read("SHM", StringArg(), _shm_name)
+        .read("SHM_SIZE", _shm_size)
+        .complete() < 0)
+        return -1;
+
+    if (key_type == "dst")
+        _key_type = KEY_DST;
+    else if (key_type == "pair")
+        _key_type = KEY_PAIR;
+    else if (key_type == "4tuple")
+        _key_type = KEY_4TUPLE;
+    else if (key_type == "5tuple")
+        _key_type = KEY_5TUPLE;
+    else
+        return errh->error("unknown KEY '%s', expected dst, pair, 4tuple or 5tuple", key_type.c_str());
+
+    if (_symmetric && _key_type == KEY_DST)
+        return errh->error("SYMMETRIC requires KEY pair, 4tuple or 5tuple");
+    if (_symmetric && _shm_name)
+        return errh->error("SYMMETRIC cannot be used with SHM");
+    if (_symmetric && _index)
+        return errh->error("SYMMETRIC cannot be used with INDEX");
+
+#if !CLICK_USERLEVEL
+    if (_shm_name)
+        return errh->error("SHM is supported only in userlevel");
+#endif
+    if (_shm_name && _index)
+        return errh->error("INDEX cannot be used with SHM");
+    if (_shm_name && !_shm_size)
+        return errh->error("SHM_SIZE must be positive");
+    if (_shm_name && _hot_size)
+        return errh->error("HOT_SIZE cannot be used with SHM");
+    if (!_adapt_interval)
+        return errh->error("ADAPT_INTERVAL must be positive");
+    if (check_adapt(_target_size, _timeout_min, _timeout_max, errh) < 0)
+        return -1;
+    if (_target_size)
+    {
+        if (_timeout > _timeout_max)
+            _timeout = _timeout_max;
+        if (_timeout < _timeout_min)
+            _timeout = _timeout_min;
+    }
+    if (_hot_size > (1U << 24))
+        return errh->error("HOT_SIZE is too large");
+    if (_doorkeeper_bits > (1U << 31))
+        return errh->error("DOORKEEPER is too large");
+    if (_doorkeeper_bits && !_doorkeeper_period)
+        return errh->error("DOORKEEPER_PERIOD must be positive");
+
+    if (_hash.configure(hash_type, rss_key, errh) < 0)
+        return -1;
+
+    if (_new_flow_rate)
+    {
+        _new_flow_bucket.assign(_new_flow_rate, _new_flow_burst ? _new_flow_burst : _new_flow_rate);
+        _new_flow_bucket.set_full();
+    }
+
+    return 0;
+}
+
+int
+FFT::initialize(ErrorHandler *errh)
+{
+    if (_doorkeeper_bits)
+    {
+        // Number of bits is rounded up to a power of two
+        uint32_t bits = 64;
+        while (bits < _doorkeeper_bits)
+            bits <<= 1;
+
+        for (int i = 0; i < 2; i++)
+        {
+            _doorkeeper[i] = (uint64_t *) CLICK_LALLOC(bits / 8);
+            if (!_doorkeeper[i])
+                return errh->error("cannot allocate doorkeeper");
+            memset(_doorkeeper[i], 0, bits / 8);
+        }
+
+        _doorkeeper_bits = bits;
+        _doorkeeper_mask = bits - 1;
+        _doorkeeper_start = Timestamp::now().msecval();
+    }
+
+    if (_shm_name)
+    {
+        _shm = new SharedFlowTable;
+        return _shm->open(_shm_name, _shm_size, _hash.type() | (_key_type << 8), errh);
+    }
+
+    if (_hot_size)
+    {
+        // Number of sets is rounded up to a power of two, sets are aligned
+        // to cache lines
+        uint32_t sets = 1;
+        while (sets * HOT_WAYS < _hot_size)
+            sets <<= 1;
+
+        _hot_mem_size = sets * sizeof(HotSet) + 63;
+        _hot_mem = CLICK_LALLOC(_hot_mem_size);
+        if (!_hot_mem)
+            return errh->error("cannot allocate hot tier");
+
+        _hot = (HotSet *) (((uintptr_t) _hot_mem + 63) & ~(uintptr_t) 63);
+        memset(_hot, 0, sets * sizeof(HotSet));
+        _hot_mask = sets - 1;
+        _hot_size = sets * HOT_WAYS;
+    }
+
+    // Controller can be enabled at run time by handler 'target_size'
+    _adapt_timer.initialize(this);
+    if (_target_size)
+        _adapt_timer.schedule_after_msec(_adapt_interval);
+
+    size_t entry_size = sizeof(FlowEntry) + (_index ? sizeof(IndexLinks) : 0)
+        + (_symmetric ? sizeof(ReverseValue) : 0);
+
+    return _arena.initialize(entry_size, _arena_prealloc, _arena_reserve,
+                             _hugepages, _numa_node, errh);
+}
+
+void
+FFT::cleanup(CleanupStage)
+{
+    // Flows in shared memory stay available to the other processes
+    delete _shm;
+    _shm = NULL;
+    clear_table();
+    _arena.cleanup();
+    if (_hot_mem)
+        CLICK_LFREE(_hot_mem, _hot_mem_size);
+    _hot_mem = NULL;
+    _hot = NULL;
+    for (int i = 0; i < 2; i++)
+    {
+        if (_doorkeeper[i])
+            CLICK_LFREE(_doorkeeper[i], _doorkeeper_bits / 8);
+        _doorkeeper[i] = NULL;
+    }
+}
+
+// NIC computes RSS hash over addresses and ports, so it can be used only
+// with keys containing them, and not with symmetric keys, as NIC hashes
+// differ between directions. Protocol of KEY_5TUPLE keys replaces the top
+// byte of the hash. NICs hash ports of TCP packets, but by default only
+// addresses of UDP packets (unless RSS_UDP is set), of other protocols and
+// of fragments, so the hash of these packets is computed. Keys built by
+// the control plane then find the entries of all flows.
+//
+// With SYMMETRIC, the key is ordered so that the lower address (and port)
+// is the source. Returns 1 if the key was reversed, i.e. it is the reverse
+// direction of its entry, 0 otherwise.
+inline bool
+FFT::rss_ports(const Packet *p)
+{
+    const click_ip *iph = p->ip_header();
+
+    return !IP_ISFRAG(iph)
+        && (iph->ip_p == IP_PROTO_TCP || (_rss_udp && iph->ip_p == IP_PROTO_UDP));
+}
+
+inline int
+FFT::hash_key(FlowKey &fkey, const Packet *p)
+{
+    uint32_t proto = fkey.h;
+    int dir = 0;
+
+    if (_symmetric && (fkey.sa.addr() > fkey.da.addr()
+                       || (fkey.sa == fkey.da && fkey.sp > fkey.dp)))
+    {
+        fkey.reverse();
+        dir = 1;
+    }
+
+    if (_hash.type() == FlowHash::RSS && p && AGGREGATE_ANNO(p) && _key_type >= KEY_4TUPLE
+        && !_symmetric && rss_ports(p))
+        fkey.h = AGGREGATE_ANNO(p);
+    else
+        fkey.h = _hash.hash(fkey.sa.addr(), fkey.da.addr(), fkey.sp, fkey.dp);
+
+    if (_key_type == KEY_5TUPLE)
+        fkey.h = (fkey.h & 0x00FFFFFF) | (proto << 24);
+
+    return dir;
+}
+
+// Previous filter is dropped, or both if no flow was recorded for a whole
+// period
+void
+FFT::doorkeeper_rotate(uint32_t now)
+{
+    if ((uint32_t) (now - _doorkeeper_start) < 2 * _doorkeeper_period)
+        _doorkeeper_cur = !_doorkeeper_cur;
+    else
+        memset(_doorkeeper[!_doorkeeper_cur], 0, _doorkeeper_bits / 8);
+
+    memset(_doorkeeper[_doorkeeper_cur], 0, _doorkeeper_bits / 8);
+    _doorkeeper_start = now;
+}
+
+// Flow passes if its run has more than one packet or if it was recorded in
+// the current or the previous period. Otherwise it is recorded now.
+inline bool
+FFT::doorkeeper_pass(uint32_t h, const Insert &ins)
+{
+    if (ins.count > 1)
+        return true;
+
+    uint32_t now = ins.ts;
+    if ((uint32_t) (now - _doorkeeper_start) >= _doorkeeper_period)
+        doorkeeper_rotate(now);
+
+    uint32_t b1 = h & _doorkeeper_mask;
+    uint32_t b2 = ((h >> 13) ^ (h * 0x9E3779B1U)) & _doorkeeper_mask;
+    uint64_t *cur = _doorkeeper[_doorkeeper_cur];
+    uint64_t *prev = _doorkeeper[!_doorkeeper_cur];
+    uint64_t m1 = (uint64_t) 1 << (b1 & 63), m2 = (uint64_t) 1 << (b2 & 63);
+
+    if ((cur[b1 >> 6] & m1) && (cur[b2 >> 6] & m2))
+        return true;
+    if ((prev[b1 >> 6] & m1) && (prev[b2 >> 6] & m2))
+        return true;
+
+    cur[b1 >> 6] |= m1;
+    cur[b2 >> 6] |= m2;
+    return false;
+}
+
+// Returns 0 if the flow is admitted, -2 if it is rejected by a limit and
+// -3 if it is deferred by the doorkeeper. Doorkeeper is checked first, so
+// flows of one packet do not take tokens. Global limit is checked before
+// the local one, but tokens are taken from both buckets only when the flow
+// is admitted.
+inline int
+FFT::admit_flow(const FlowKey &fkey, const Insert *ins, TokenBucket *limiter)
+{
+    if (_doorkeeper_bits && ins && !doorkeeper_pass(fkey.h, *ins))
+    {
+        _deferred++;
+        return -3;
+    }
+
+    if (_new_flow_rate)
+    {
+        _new_flow_bucket.fill();
+        if (!_new_flow_bucket.contains(1))
+        {
+            _rejected_global++;
+            return -2;
+        }
+    }
+
+    if (limiter)
+    {
+        limiter->fill();
+        if (!limiter->remove_if(1))
+        {
+            _rejected_local++;
+            return -2;
+        }
+    }
+
+    if (_new_flow_rate)
+        _new_flow_bucket.remove(1);
+
+    _admitted++;
+    return 0;
+}
+
+// New entries are subject to admission control only if 'status' is given,
+// it is set to the result of admit_flow() if the flow is not admitted
+FFT::FlowEntry *
+FFT::find_insert(const FlowKey &fkey, const Insert *ins, TokenBucket *limiter, int *status)
+{
+    auto it = _table.find(fkey);
+
+    // Entry is going to be modified, so its hot copy is written back
+    if (it)
+    {
+        if (_hot)
+            hot_flush(it.get());
+        return it.get();
+    }
+
+    if (status && (*status = admit_flow(fkey, ins, limiter)) < 0)
+        return NULL;
+
+    void *p = _arena.alloc();
+    if (!p)
+        return NULL;
+
+    FlowEntry *e = new(p) FlowEntry(fkey);
+    _table.set(it, e, true);
+    _inserted++;
+
+    if (_symmetric)
+        *reverse_value(e) = ReverseValue();
+
+    if (_index)
+    {
+        links(e)->nh_link.pprev = NULL;
+        index_link(_dst_index[ntohl(fkey.da.addr()) >> 8], e, &IndexLinks::dst_link);
+    }
+
+    return e;
+}
+
+inline void
+FFT::index_link(FlowEntry *&head, FlowEntry *e, IndexLink IndexLinks::*l)
+{
+    (links(e)->*l).next = head;
+    (links(e)->*l).pprev = &head;
+    if (head)
+        (links(head)->*l).pprev = &(links(e)->*l).next;
+    head = e;
+}
+
+// Returns true if the entry was the last one in the list, so the list
+// may have become empty
+inline bool
+FFT::index_unlink(FlowEntry *e, IndexLink IndexLinks::*l)
+{
+    IndexLink &link = links(e)->*l;
+
+    if (!link.pprev)
+        return false;
+
+    FlowEntry *next = link.next;
+    *link.pprev = next;
+    if (next)
+        (links(next)->*l).pprev = link.pprev;
+    link.pprev = NULL;
+    return !next;
+}
+
+template <typename K, typename V>
+static inline void
+index_erase_empty(HashTable<K, V> &index, const K &key)
+{
+    auto it = index.find(key);
+    if (it && !it.value())
+        index.erase(it);
+}
+
+inline void
+FFT::index_remove(FlowEntry *e)
+{
+    if (index_unlink(e, &IndexLinks::dst_link))
+        index_erase_empty(_dst_index, ntohl(e->key.da.addr()) >> 8);
+    if (index_unlink(e, &IndexLinks::nh_link))
+        index_erase_empty(_nh_index, e->value.nexthop);
+}
+
+static inline uint64_t
+nexthop_key(IPAddress gateway, uint8_t port)
+{
+    return ((uint64_t) gateway.addr() << 8) | port;
+}
+
+// Returns index of the next hop with a new reference, or -1 if the table
+// is full
+int
+FFT::get_nexthop(IPAddress gateway, uint8_t port)
+{
+    auto it = _nexthop_map.find(nexthop_key(gateway, port));
+
+    if (it)
+    {
+        _nexthops[it.value()].refs++;
+        return it.value();
+    }
+
+    int nh;
+
+    if (!_nexthops.size())
+        _nexthops.push_back(NextHop());
+
+    if (_free_nexthops.size())
+    {
+        nh = _free_nexthops.back();
+        _free_nexthops.pop_back();
+    }
+    else if (_nexthops.size() < MAX_NEXTHOPS)
+    {
+        nh = _nexthops.size();
+        _nexthops.push_back(NextHop());
+    }
+    else
+        return -1;
+
+    _nexthops[nh].gateway = gateway;
+    _nexthops[nh].port = port;
+    _nexthops[nh].refs = 1;
+    _nexthop_map.set(nexthop_key(gateway, port), nh);
+    return nh;
+}
+
+void
+FFT::put_nexthop(uint16_t nh)
+{
+    if (nh && --_nexthops[nh].refs == 0)
+    {
+        auto it = _nexthop_map.find(nexthop_key(_nexthops[nh].gateway, _nexthops[nh].port));
+        if (it && it.value() == nh)
+            _nexthop_map.erase(it);
+        _free_nexthops.push_back(nh);
+    }
+}
+
+// Takes over the reference returned by get_nexthop()
+inline void
+FFT::set_nexthop(FlowEntry *e, int dir, uint16_t nh)
+{
+    uint16_t old = dir_nexthop(e, dir);
+
+    if (old == nh)
+    {
+        put_nexthop(nh);
+        return;
+    }
+
+    if (_port_stats)
+    {
+        uint8_t port = _nexthops[nh].port;
+        if (old)
+            _ports[_nexthops[old].port].entries--;
+        else
+            port_stats(port).new_flow_rate.update(1);
+        port_stats(port).entries++;
+    }
+
+    if (_index)
+    {
+        if (index_unlink(e, &IndexLinks::nh_link))
+            index_erase_empty(_nh_index, old);
+        index_link(_nh_index[nh], e, &IndexLinks::nh_link);
+    }
+
+    put_nexthop(old);
+    dir_nexthop(e, dir) = nh;
+}
+
+// Returns false if the next hop table is full. New entry without next hop
+// is erased in that case.
+inline bool
+FFT::update_nexthop(FlowEntry *e, int dir, IPAddress gateway, uint8_t port)
+{
+    uint16_t old = dir_nexthop(e, dir);
+
+    if (old && _nexthops[old].gateway == gateway && _nexthops[old].port == port)
+        return true;
+
+    int nh = get_nexthop(gateway, port);
+
+    if (nh < 0)
+    {
+        if (!has_nexthop(e))
+            erase_entry(e);
+        return false;
+    }
+
+    set_nexthop(e, dir, nh);
+    return true;
+}
+
+inline bool
+FFT::has_nexthop(FlowEntry *e)
+{
+    return e->value.nexthop || (_symmetric && reverse_value(e)->nexthop);
+}
+
+// Returns true if the entry is to be erased by a removal operation, i.e.
+// if match(entry, direction, next hop) is true for its next hop. With
+// SYMMETRIC, next hops of matching directions are released instead and
+// the entry is to be erased only if no direction is left.
+template <typename M> inline bool
+FFT::release_matching(FlowEntry *e, M match)
+{
+    if (!_symmetric)
+        return match(e, 0, _nexthops[e->value.nexthop]);
+
+    bool flushed = false;
+
+    for (int dir = 0; dir < 2; dir++)
+    {
+        uint16_t &nh = dir_nexthop(e, dir);
+
+        if (!nh || !match(e, dir, _nexthops[nh]))
+            continue;
+
+        // Hot copy holds the next hop too
+        if (_hot && !flushed)
+        {
+            hot_flush(e);
+            flushed = true;
+        }
+        if (_port_stats)
+            _ports[_nexthops[nh].port].entries--;
+        put_nexthop(nh);
+        nh = 0;
+    }
+
+    return !has_nexthop(e);
+}
+
+inline FFT::PortStats &
+FFT::port_stats(uint8_t port)
+{
+    if (port >= _ports.size())
+        _ports.resize(port + 1);
+    return _ports[port];
+}
+
+inline void
+FFT::account(uint8_t port, uint32_t packets, uint64_t bytes)
+{
+    if (_port_stats)
+    {
+        PortStats &ps = port_stats(port);
+        ps.packet_rate.update(packets);
+        ps.byte_rate.update(bytes);
+    }
+}
+
+inline void
+FFT::release_entry(FlowEntry *e)
+{
+    if (_index)
+        index_remove(e);
+    if (_hot)
+        if (HotSlot *s = hot_slot(e))
+            s->entry = NULL;
+
+    for (int dir = 0; dir < (_symmetric ? 2 : 1); dir++)
+    {
+        uint16_t nh = dir_nexthop(e, dir);
+        if (_port_stats && nh)
+            _ports[_nexthops[nh].port].entries--;
+        put_nexthop(nh);
+    }
+
+    e->~FlowEntry();
+    _arena.free(e);
+}
+
+inline void
+FFT::erase_entry(HashContainer<FlowEntry>::iterator &it)
+{
+    FlowEntry *e = it.get();
+    it = _table.erase(it);
+    release_entry(e);
+}
+
+void
+FFT::erase_entry(FlowEntry *e)
+{
+    _table.erase(e->key);
+    release_entry(e);
+}
+
+inline FFT::HotSlot *
+FFT::hot_find(const FlowKey &fkey)
+{
+    HotSet &set = hot_set(fkey.h);
+
+    for (int w = 0; w < HOT_WAYS; w++)
+    {
+        HotSlot &s = set.slot[w];
+
+        if (s.entry && s.sa == fkey.sa.addr() && s.da == fkey.da.addr()
+            && s.sp == fkey.sp && s.dp == fkey.dp && s.h_top == (fkey.h >> 24))
+        {
+            if (w)
+            {
+                HotSlot hit = s;
+                for (int i = w; i > 0; i--)
+                    set.slot[i] = set.slot[i - 1];
+                set.slot[0] = hit;
+            }
+            return &set.slot[0];
+        }
+    }
+
+    return NULL;
+}
+
+inline FFT::HotSlot *
+FFT::hot_slot(const FlowEntry *e)
+{
+    HotSet &set = hot_set(e->key.h);
+
+    for (int w = 0; w < HOT_WAYS; w++)
+        if (set.slot[w].entry == e)
+            return &set.slot[w];
+
+    return NULL;
+}
+
+// Entry must not be in the hot tier already. The least recently used slot
+// of the set is evicted.
+inline void
+FFT::hot_promote(FlowEntry *e)
+{
+    HotSet &set = hot_set(e->key.h);
+    HotSlot &last = set.slot[HOT_WAYS - 1];
+
+    if (last.entry)
+    {
+        last.entry->value.ts = last.ts;
+        last.entry->value.ttl = last.ttl;
+        last.entry->value.epoch = last.epoch;
+        if (_symmetric)
+            reverse_value(last.entry)->ttl = last.rev_ttl;
+    }
+
+    for (int i = HOT_WAYS - 1; i > 0; i--)
+        set.slot[i] = set.slot[i - 1];
+
+    HotSlot &s = set.slot[0];
+    s.sa = e->key.sa.addr();
+    s.da = e->key.da.addr();
+    s.sp = e->key.sp;
+    s.dp = e->key.dp;
+    s.h_top = e->key.h >> 24;
+    s.entry = e;
+    s.ts = e->value.ts;
+    s.nexthop = e->value.nexthop;
+    s.ttl = e->value.ttl;
+    s.epoch = e->value.epoch;
+    s.rev_nexthop = _symmetric ? reverse_value(e)->nexthop : 0;
+    s.rev_ttl = _symmetric ? reverse_value(e)->ttl : 0;
+}
+
+inline void
+FFT::hot_flush(FlowEntry *e)
+{
+    if (HotSlot *s = hot_slot(e))
+    {
+        e->value.ts = s->ts;
+        e->value.ttl = s->ttl;
+        e->value.epoch = s->epoch;
+        if (_symmetric)
+            reverse_value(e)->ttl = s->rev_ttl;
+        s->entry = NULL;
+    }
+}
+
+// Timestamp of the entry, which may be newer in its hot copy
+inline uint32_t
+FFT::entry_ts(const FlowEntry *e)
+{
+    if (_hot)
+        if (HotSlot *s = hot_slot(e))
+            return s->ts;
+    return e->value.ts;
+}
+
+// Directions of symmetric entries are reported as separate flows
+inline void
+FFT::notify_added(FlowEntry *e, int dir)
+{
+    const NextHop &nh = _nexthops[dir_nexthop(e, dir)];
+    uint8_t proto = _key_type == KEY_5TUPLE ? e->key.h >> 24 : 0;
+    FlowKey k = e->key;
+    if (dir)
+        k.reverse();
+    _listener->flow_added(k.sa, k.da, k.sp, k.dp, proto, nh.gateway, nh.port, dir_ttl(e, dir));
+}
+
+// Listener is notified about flows added by packets and about removals.
+// Each active flow is reported again once per 'refresh_period'
+// milliseconds, so that a replica can keep it from expiring.
+int
+FFT::set_listener(FFTListener *listener, uint32_t refresh_period, ErrorHandler *errh)
+{
+    if (_listener && listener)
+        return errh->error("%s: table has already a listener", name().c_str());
+    if (_shm && listener)
+        return errh->error("%s: table with SHM cannot be replicated", name().c_str());
+
+    _listener = listener;
+    _refresh_period = refresh_period ? refresh_period : 1;
+    return 0;
+}
+
+void
+FFT::clear()
+{
+#if FFT_DETAILED_STATS
+    _overwritten_flows.clear();
+#endif
+    if (_shm)
+        _shm->remove_if([](const SharedFlowTable::Entry &) { return true; });
+    else
+        clear_table();
+
+    if (_listener)
+        _listener->cleared();
+}
+
+void
+FFT::clear_table()
+{
+    auto it = _table.begin();
+
+    while (it)
+        erase_entry(it);
+}
+
+inline SharedFlowTable::Key
+FFT::shm_key(const FlowKey &fkey)
+{
+    SharedFlowTable::Key key;
+    key.sa = fkey.sa.addr();
+    key.da = fkey.da.addr();
+    key.sp = fkey.sp;
+    key.dp = fkey.dp;
+    key.hash = fkey.h;
+    return key;
+}
+
+// Timestamps are stored in shared memory as wrapping 32-bit milliseconds,
+// so all processes must use the same clock for packet timestamps
+int
+FFT::shm_add_flow(const FlowKey &fkey, uint32_t ts, IPAddress gateway, uint8_t port, uint8_t ttl,
+                  bool overwrite_existing, const Insert *ins, TokenBucket *limiter)
+{
+    SharedFlowTable::Key key = shm_key(fkey);
+
+    if ((_new_flow_rate || limiter || (_doorkeeper_bits && ins)) && !_shm->contains(key))
+    {
+        int r = admit_flow(fkey, ins, limiter);
+        if (r < 0)
+            return r;
+    }
+
+    return _shm->insert(key, ts, gateway.addr(), port, ttl,
+                        overwrite_existing, _timeout, _loop_avoidance);
+}
+
+int
+FFT::shm_check(Packet *p, IPAddress &gateway)
+{
+    FlowKey fkey(p, _key_type);
+    hash_key(fkey, p);
+
+    int ttl = _loop_avoidance && p->has_network_header() ? p->ip_header()->ip_ttl : -1;
+    uint8_t port;
+    uint32_t gw;
+
+    if (!_shm->check(shm_key(fkey), p->timestamp_anno().msecval(), _timeout, ttl, port, gw))
+        return -1;
+
+    gateway = IPAddress(gw);
+    return port;
+}
+
+int
+FFT::add_flow(IPAddress src_addr, IPAddress dst_addr, uint16_t src_port, uint16_t dst_port,
+              Timestamp ts, IPAddress gateway, uint8_t port, uint8_t ttl, bool overwrite_existing,
+              uint8_t proto)
+{
+    FFT_LATENCY(LAT_ADD);
+    FlowKey fkey(src_addr, dst_addr, src_port, dst_port);
+    fkey.normalize(_key_type, proto);
+    int dir = hash_key(fkey, NULL);
+
+    if (_shm)
+    {
+        int r = shm_add_flow(fkey, ts.msecval(), gateway, port, ttl, overwrite_existing, NULL, NULL);
+        return r < 0 ? -1 : 0;
+    }
+
+    FlowEntry *e = find_insert(fkey);
+
+    if (!e)
+        return -1;
+
+    FlowValue &fval = e->value;
+    uint16_t &nexthop = dir_nexthop(e, dir);
+    uint32_t ts_ms = ts.msecval();
+
+    if (!overwrite_existing)
+        if (nexthop && !is_expired(ts_ms, fval.ts))
+            if (!_loop_avoidance || dir_ttl(e, dir) == ttl)
+                return -1;
+
+#if FFT_DETAILED_STATS
+    if (nexthop)
+        print_flow_info(&_overwritten_flows, fkey, fval, _nexthops[nexthop].port, ts_ms);
+#endif
+
+    if (!update_nexthop(e, dir, gateway, port))
+        return -1;
+
+    fval.ts = ts_ms;
+    dir_ttl(e, dir) = ttl;
+
+#if FFT_DETAILED_STATS
+    fval.first = 0;
+    fval.last = 0;
+    fval.packets = 0;
+    fval.bytes = 0;
+#endif
+
+    if (_gc_on_add)
+        bucket_garbage_collection(fkey, ts_ms);
+
+    return 0;
+}
+
+int
+FFT::add_flow(Packet *p, uint8_t port, TokenBucket *limiter)
+{
+    PacketRun run = { p, p, 1, p->length() };
+    return add_flow(run, port, limiter);
+}
+
+// Key is taken from the first packet of the run and timestamp from the last
+// one
+void
+FFT::make_insert(const PacketRun &run, uint8_t port, Insert &ins)
+{
+    Packet *p = run.first;
+    FlowKey fkey(p, _key_type);
+
+    ins.dir = hash_key(fkey, p);
+    ins.src_addr = fkey.sa.addr();
+    ins.dst_addr = fkey.da.addr();
+    ins.src_port = fkey.sp;
+    ins.dst_port = fkey.dp;
+    ins.hash = fkey.h;
+    ins.gateway = p->dst_ip_anno().addr();
+    ins.ts = run.last->timestamp_anno().msecval();
+    ins.count = run.count;
+    ins.bytes = run.bytes;
+    ins.port = port;
+    ins.ttl = p->has_network_header() ? p->ip_header()->ip_ttl : 0;
+#if FFT_DETAILED_STATS
+    ins.first = p->timestamp_anno();
+    ins.last = run.last->timestamp_anno();
+#endif
+}
+
+int
+FFT::add_flow(const PacketRun &run, uint8_t port, TokenBucket *limiter)
+{
+    Insert ins;
+
+    make_insert(run, port, ins);
+    return insert_flow(ins, limiter, _gc_on_add);
+}
+
+int
+FFT::add_flow(const Insert &ins, TokenBucket *limiter)
+{
+    return insert_flow(ins, limiter, _gc_on_add);
+}
+
+inline FFT::FlowKey
+FFT::insert_key(const Insert &ins)
+{
+    FlowKey fkey(IPAddress(ins.src_addr), IPAddress(ins.dst_addr), ins.src_port, ins.dst_port);
+    fkey.h = ins.hash;
+    return fkey;
+}
+
+static int
+bucket_compar(const void *a, const void *b, void *)
+{
+    uint64_t ba = *(const uint64_t *) a;
+    uint64_t bb = *(const uint64_t *) b;
+    return ba < bb ? -1 : (ba > bb ? 1 : 0);
+}
+
+// Insertions are applied in order, hot set of the next one is prefetched.
+// Buckets are garbage collected (GC_ON_ADD) after all insertions: records
+// are sorted by bucket and each distinct bucket is collected once, with the
+// newest timestamp of its records.
+void
+FFT::add_flows(const Insert *ins, int n, TokenBucket *limiter, int *results)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (_hot && i + 1 < n)
+            __builtin_prefetch(&hot_set(ins[i + 1].hash));
+        results[i] = insert_flow(ins[i], limiter, false);
+    }
+
+    if (!_gc_on_add || _shm || !n)
+        return;
+
+    uint32_t buckets = _table.bucket_count();
+
+    // Bucket in the upper half, index of the record in the lower half
+    Vector<uint64_t> order;
+    order.reserve(n);
+    for (int i = 0; i < n; i++)
+        order.push_back((uint64_t) (ins[i].hash % buckets) << 32 | (uint32_t) i);
+
+    click_qsort(order.begin(), order.size(), sizeof(uint64_t), bucket_compar);
+
+    for (int i = 0; i < order.size();)
+    {
+        uint32_t bucket = order[i] >> 32;
+        const Insert *newest = &ins[(uint32_t) order[i]];
+
+        for (i++; i < order.size() && (order[i] >> 32) == bucket; i++)
+            if ((int32_t) (ins[(uint32_t) order[i]].ts - newest->ts) > 0)
+                newest = &ins[(uint32_t) order[i]];
+
+        bucket_garbage_collection(insert_key(*newest), newest->ts);
+    }
+}
+
+int
+FFT::insert_flow(const Insert &ins, TokenBucket *limiter, bool gc)
+{
+    FFT_LATENCY(LAT_ADD);
+    FlowKey fkey = insert_key(ins);
+    int dir = ins.dir;
+
+    if (_shm)
+    {
+        int r = shm_add_flow(fkey, ins.ts, IPAddress(ins.gateway), ins.port, ins.ttl, true,
+                             &ins, limiter);
+        if (r == 0)
+            account(ins.port, ins.count, ins.bytes);
+        return r;
+    }
+
+    int status = 0;
+    FlowEntry *e = find_insert(fkey, &ins, limiter, &status);
+
+    if (!e)
+        return status < 0 ? status : -1;
+
+    FlowValue &fval = e->value;
+    uint16_t nexthop = dir_nexthop(e, dir);
+
+    // Reverse direction of a symmetric entry is not repinned
+    if (nexthop)
+        _repinned++;
+
+#if FFT_DETAILED_STATS
+    if (nexthop)
+        print_flow_info(&_overwritten_flows, fkey, fval, _nexthops[nexthop].port, ins.ts);
+#endif
+
+    if (!update_nexthop(e, dir, IPAddress(ins.gateway), ins.port))
+        return -1;
+
+    fval.ts = ins.ts;
+    account(ins.port, ins.count, ins.bytes);
+    dir_ttl(e, dir) = ins.ttl;
+
+    if (_listener)
+    {
+        fval.epoch = refresh_epoch(ins.ts);
+        notify_added(e, dir);
+    }
+
+#if FFT_DETAILED_STATS
+    fval.first = ins.first;
+    fval.last = ins.last;
+    fval.packets = ins.count;
+    fval.bytes = ins.bytes;
+#endif
+
+    if (gc)
+        bucket_garbage_collection(fkey, ins.ts);
+
+    return 0;
+}
+
+// Validates the value (of an entry or its hot copy) and next hop and TTL
+// of direction 'dir' with the first packet of the run and refreshes the
+// value with the last one. Next hop 0 means that the direction is not in
+// the entry.
+template <typename V> inline bool
+FFT::refresh_value(const PacketRun &run, FlowEntry *e, V &val, int dir, uint16_t nexthop,
+                   uint8_t &ttl)
+{
+    Packet *p = run.first;
+
+    if (!nexthop || is_expired(p->timestamp_anno().msecval(), val.ts))
+        return false;
+
+    // TTL 0 is stored by flows programmed without TTL, it is learned from
+    // the first packet
+    if (_loop_avoidance && p->has_network_header())
+        if (ttl != p->ip_header()->ip_ttl)
+        {
+            if (ttl)
+                return false;
+            ttl = p->ip_header()->ip_ttl;
+        }
+
+    account(_nexthops[nexthop].port, run.count, run.bytes);
+    val.ts = run.last->timestamp_anno().msecval();
+    if (_listener && val.epoch != refresh_epoch(val.ts))
+    {
+        val.epoch = refresh_epoch(val.ts);
+        notify_added(e, dir);
+    }
+#if FFT_DETAILED_STATS
+    e->value.last = run.last->timestamp_anno();
+    e->value.packets += run.count;
+    e->value.bytes += run.bytes;
+#endif
+
+    return true;
+}
+
+// Returns next hop of the run's flow if its entry is active and TTL
+// matches, 0 otherwise. Entries hit in the table are promoted to the hot
+// tier.
+uint16_t
+FFT::check_entry(const PacketRun &run)
+{
+    FlowKey fkey(run.first, _key_type);
+    int dir = hash_key(fkey, run.first);
+    FlowEntry *e = NULL;
+    uint16_t nexthop = 0;
+
+    if (_hot)
+    {
+        HotSlot *s = hot_find(fkey);
+        if (s)
+        {
+            _hot_hits++;
+            e = s->entry;
+            if (refresh_value(run, e, *s, dir, s->dir_nexthop(dir), s->dir_ttl(dir)))
+                nexthop = s->dir_nexthop(dir);
+        }
+        else
+            _hot_misses++;
+    }
+
+    if (!e)
+    {
+        e = _table.get(fkey);
+        if (!e)
+            return 0;
+        if (refresh_value(run, e, e->value, dir, dir_nexthop(e, dir), dir_ttl(e, dir)))
+        {
+            nexthop = dir_nexthop(e, dir);
+            if (_hot)
+                hot_promote(e);
+        }
+    }
+
+    // Entry just refreshed is not expired, so it is not removed here
+    if (_gc_on_check)
+        bucket_garbage_collection(fkey, run.first->timestamp_anno().msecval());
+
+    return nexthop;
+}
+
+inline void
+FFT::set_gateway_anno(const PacketRun &run, IPAddress gateway)
+{
+    for (Packet *p = run.first; ; p = p->next())
+    {
+        p->set_dst_ip_anno(gateway);
+        if (p == run.last)
+            break;
+    }
+}
+
+int
+FFT::check_flow(Packet *p)
+{
+    PacketRun run = { p, p, 1, p->length() };
+    return check_flow(run);
+}
+
+int
+FFT::check_flow(const PacketRun &run)
+{
+    FFT_LATENCY(LAT_CHECK);
+    IPAddress gateway;
+
+    if (_shm)
+    {
+        int port = shm_check(run.first, gateway);
+        if (port < 0)
+            return 0;
+        account(port, run.count, run.bytes);
+        return 1;
+    }
+
+    return check_entry(run) ? 1 : 0;
+}
+
+int
+FFT::check_route_flow(Packet *p)
+{
+    PacketRun run = { p, p, 1, p->length() };
+    return check_route_flow(run);
+}
+
+int
+FFT::check_route_flow(const PacketRun &run)
+{
+    FFT_LATENCY(LAT_CHECK);
+    int port;
+    IPAddress gateway;
+
+    if (_shm)
+    {
+        port = shm_check(run.first, gateway);
+        if (port < 0)
+            return -1;
+        account(port, run.count, run.bytes);
+    }
+    else
+    {
+        uint16_t nexthop = check_entry(run);
+        if (!nexthop)
+            return -1;
+        const NextHop &nh = _nexthops[nexthop];
+        port = nh.port;
+        gateway = nh.gateway;
+    }
+
+    if (gateway)
+        set_gateway_anno(run, gateway);
+    return port;
+}
+
+int
+FFT::route_flow(Packet *p)
 {
+    PacketRun run = { p, p, 1, p->length() };
+    return route_flow(run);
 }
 
-FFT::~FFT()
-{
+int
+FFT::route_flow(const PacketRun &run)
+{
+    FFT_LATENCY(LAT_ROUTE);
+    Packet *p = run.first;
+    FlowKey fkey(p, _key_type);
+    int dir = hash_key(fkey, p);
+
+    uint8_t port;
+    IPAddress gateway;
+
+    if (_shm)
+    {
+        uint32_t gw;
+        if (!_shm->get(shm_key(fkey), port, gw))
+            return -1;
+        gateway = IPAddress(gw);
+    }
+    else
+    {
+        HotSlot *s = _hot ? hot_find(fkey) : NULL;
+        uint16_t nexthop;
+
+        if (s)
+        {
+            _hot_hits++;
+            nexthop = s->dir_nexthop(dir);
+        }
+        else
+        {
+            if (_hot)
+                _hot_misses++;
+            FlowEntry *e = _table.get(fkey);
+            if (!e)
+                return -1;
+            nexthop = dir_nexthop(e, dir);
+            if (_hot)
+                hot_promote(e);
+        }
+
+        if (!nexthop)
+            return -1;
+
+        const NextHop &nh = _nexthops[nexthop];
+        port = nh.port;
+        gateway = nh.gateway;
+    }
+
+    if (gateway)
+        set_gateway_anno(run, gateway);
+    return port;
 }
 
+// Returns 1 if the flow had an entry, 0 otherwise
 int
-FFT::configure(Vector<String> &conf, ErrorHandler *errh)
+FFT::remove_flow(IPAddress src_addr, IPAddress dst_addr, uint16_t src_port, uint16_t dst_port,
+                 uint8_t proto)
 {
-    if (Args(conf, this, errh)
-        .read("TIMEOUT", SecondsArg(3), _timeout)
-        .read("LOOP_AVOIDANCE", _loop_avoidance)
-        .read("GC_ON_ADD", _gc_on_add)
-        .read("GC_ON_CHECK", _gc_on_check)
-        .complete() < 0)
-        return -1;
+    FFT_LATENCY(LAT_REMOVE);
+    FlowKey fkey(src_addr, dst_addr, src_port, dst_port);
+    fkey.normalize(_key_type, proto);
+    int dir = hash_key(fkey, NULL);
 
-    return 0;
+    if (_listener)
+        _listener->flow_removed(fkey.sa, fkey.da, fkey.sp, fkey.dp,
+                                _key_type == KEY_5TUPLE ? proto : 0);
+
+    if (_shm)
+        return _shm->remove(shm_key(fkey)) ? 1 : 0;
+
+    FlowEntry *e = _table.get(fkey);
+    if (!e || (_symmetric && !dir_nexthop(e, dir)))
+        return 0;
+
+    // Only the given direction of a symmetric entry is removed
+    if (release_matching(e, [dir](const FlowEntry *, int d, const NextHop &) { return d == dir; }))
+        erase_entry(e);
+    return 1;
 }
 
+// All records are validated before any of them is applied, so a malformed
+// batch is rejected as a whole. Application is best effort: a record which
+// fails (e.g. arena or next hop table full) is skipped and the following
+// ones are still applied. Added and modified flows are timestamped with the
+// current time. Returns the number of records, which changed the table.
 int
-FFT::initialize(ErrorHandler *)
+FFT::apply_bulk(const BulkRecord *records, int n, ErrorHandler *errh)
 {
-    return 0;
+    for (int i = 0; i < n; i++)
+        if (records[i].op < BULK_ADD || records[i].op > BULK_REMOVE)
+            return errh->error("record %d: unknown operation %d", i, records[i].op);
+
+    Timestamp now = Timestamp::now();
+    int applied = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        const BulkRecord &r = records[i];
+        IPAddress src_addr(r.src_addr), dst_addr(r.dst_addr), gateway(r.gateway);
+
+        if (r.op == BULK_REMOVE)
+            applied += remove_flow(src_addr, dst_addr, r.src_port, r.dst_port, r.proto);
+        else if (add_flow(src_addr, dst_addr, r.src_port, r.dst_port, now, gateway, r.port, r.ttl,
+                          r.op == BULK_MODIFY, r.proto) == 0)
+        {
+            applied++;
+            if (_listener)
+            {
+                // Reported with the normalized key, as flows added by packets
+                FlowKey fkey(src_addr, dst_addr, r.src_port, r.dst_port);
+                fkey.normalize(_key_type, r.proto);
+                _listener->flow_added(fkey.sa, fkey.da, fkey.sp, fkey.dp,
+                                      _key_type == KEY_5TUPLE ? r.proto : 0, gateway, r.port, r.ttl);
+            }
+        }
+    }
+
+    _bulk_records += n;
+    _bulk_applied += applied;
+    return applied;
 }
 
 void
-FFT::cleanup(CleanupStage)
+FFT::remove_flows(uint8_t port)
 {
+    FFT_LATENCY(LAT_REMOVE);
+
+    if (_listener)
+        _listener->port_removed(port);
+    if (_shm)
+    {
+        _shm->remove_if([port](const SharedFlowTable::Entry &e) { return e.port == port; });
+        return;
+    }
+
+    auto it = _table.begin();
 
+    while (it)
+    {
+        if (release_matching(it.get(), [port](const FlowEntry *, int, const NextHop &nh) {
+                return nh.port == port;
+            }))
+            erase_entry(it);
+        else
+            it++;
+    }
 }
 
+// With index, the cost is proportional to the number of removed flows and,
+// for prefixes shorter than /24, to the number of destination /24 networks
+// present in the table. Without index, the whole table is scanned.
 int
-FFT::add_flow(IPAddress src_addr, IPAddress dst_addr, uint16_t src_port, uint16_t dst_port,
-              Timestamp ts, IPAddress gateway, uint8_t port, uint8_t ttl, bool overwrite_existing)
+FFT::remove_prefix(IPAddress addr, IPAddress mask)
 {
-    FlowKey fkey(src_addr, dst_addr, src_port, dst_port);
-    FlowValue &fval = _table[fkey];
+    FFT_LATENCY(LAT_REMOVE);
+    int removed = 0;
+    int len = mask.mask_to_prefix_len();
+    addr &= mask;
 
-    if (!overwrite_existing)
-        if (fval.ts != 0 && !is_expired(ts, fval.ts))
-            if (!_loop_avoidance || fval.ttl == ttl)
-                return -1;
+    if (_listener)
+        _listener->prefix_removed(addr, mask);
 
-#if FFT_DETAILED_STATS
-    if (fval->ts != 0)
-        print_flow_info(&_overwritten_flows, fkey, fval, ts);
-#endif
+    if (_shm)
+    {
+        uint32_t a = addr.addr(), m = mask.addr();
+        return _shm->remove_if([a, m](const SharedFlowTable::Entry &e) {
+            return (e.key.da & m) == a;
+        });
+    }
 
-    fval.ts = ts;
-    fval.gateway = gateway;
-    fval.port = port;
-    fval.ttl = ttl;
+    if (!_index || len < 0)
+    {
+        auto it = _table.begin();
 
-#if FFT_DETAILED_STATS
-    fval.first = 0;
-    fval.last = 0;
-    fval.packets = 0;
-    fval.bytes = 0;
-#endif
+        // Destination of the reverse direction of a symmetric entry is the
+        // source of its key
+        while (it)
+        {
+            if (release_matching(it.get(), [addr, mask](const FlowEntry *e, int dir, const NextHop &) {
+                    return (dir ? e->key.sa : e->key.da).matches_prefix(addr, mask);
+                }))
+            {
+                erase_entry(it);
+                removed++;
+            }
+            else
+                it++;
+        }
 
-    if (_gc_on_add)
-        bucket_garbage_collection(fkey, ts);
+        return removed;
+    }
 
-    return 0;
-}
+    uint32_t a = ntohl(addr.addr());
 
-int
-FFT::add_flow(Packet *p, uint8_t port)
-{
-    Timestamp p_ts = p->timestamp_anno();
+    if (len >= 24)
+    {
+        Vector<FlowEntry *> entries;
 
-    FlowKey fkey(p);
-    FlowValue &fval = _table[fkey];
+        for (FlowEntry *e = _dst_index.get(a >> 8); e; e = links(e)->dst_link.next)
+            if (e->key.da.matches_prefix(addr, mask))
+                entries.push_back(e);
 
-#if FFT_DETAILED_STATS
-    if (fval->ts != 0)
-        print_flow_info(&_overwritten_flows, fkey, fval, p_ts);
-#endif
+        for (int i = 0; i < entries.size(); i++)
+            erase_entry(entries[i]);
 
-    fval.ts = p_ts;
-    fval.gateway = p->dst_ip_anno();
-    fval.port = port;
+        return entries.size();
+    }
 
-    if (p->has_network_header())
-        fval.ttl = p->ip_header()->ip_ttl;
-    else
-        fval.ttl = 0;
+    uint32_t net_mask = len > 0 ? 0xFFFFFFFFU << (32 - len) : 0;
+    Vector<uint32_t> nets;
 
-#if FFT_DETAILED_STATS
-    fval.first = p_ts;
-    fval.last = p_ts;
-    fval.packets = 1;
-    fval.bytes = p->length();
-#endif
+    for (auto it = _dst_index.begin(); it; it++)
+        if (((it.key() << 8) & net_mask) == a)
+            nets.push_back(it.key());
 
-    if (_gc_on_add)
-        bucket_garbage_collection(fkey, p_ts);
+    for (int i = 0; i < nets.size(); i++)
+    {
+        FlowEntry *e;
+        while ((e = _dst_index.get(nets[i])))
+        {
+            erase_entry(e);
+            removed++;
+        }
+    }
 
-    return 0;
+    return removed;
+}
+
+// Returns true if any of the sorted, disjoint ranges overlaps first..last
+static inline bool
+ranges_overlap(const Vector<FFT::AddressRange> &ranges, uint32_t first, uint32_t last)
+{
+    int lo = 0, hi = ranges.size();
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (ranges[mid].last < first)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo < ranges.size() && ranges[lo].first <= last;
 }
 
+// Removes flows with destination in any of the ranges, which must be sorted
+// and disjoint, in one pass over the table (or over the destination index)
+// for all of them. Listener is notified of the largest aligned prefixes
+// covering the ranges.
 int
-FFT::check_flow(Packet *p)
+FFT::remove_ranges(const Vector<AddressRange> &ranges)
 {
-    int ret;
-    Timestamp p_ts = p->timestamp_anno();
+    FFT_LATENCY(LAT_REMOVE);
+    int removed = 0;
 
-    FlowKey fkey(p);
-    FlowValue *fval = _table.get_pointer(fkey);
+    if (!ranges.size())
+        return 0;
 
-    ret = 0;
+    if (_listener)
+        for (int i = 0; i < ranges.size(); i++)
+            for (uint64_t a = ranges[i].first, size; a <= ranges[i].last; a += size)
+            {
+                int len = 32;
+                size = 1;
+                while (len > 0 && !(a & (2 * size - 1)) && a + 2 * size - 1 <= ranges[i].last)
+                {
+                    size *= 2;
+                    len--;
+                }
+                _listener->prefix_removed(IPAddress(htonl((uint32_t) a)),
+                                          IPAddress::make_prefix(len));
+            }
 
-    if (fval)
+    if (_shm)
+        return _shm->remove_if([&ranges](const SharedFlowTable::Entry &e) {
+            uint32_t a = ntohl(e.key.da);
+            return ranges_overlap(ranges, a, a);
+        });
+
+    if (!_index)
     {
-        ret = 1;
+        auto it = _table.begin();
+
+        while (it)
+        {
+            if (release_matching(it.get(), [&ranges](const FlowEntry *e, int dir, const NextHop &) {
+                    uint32_t a = ntohl((dir ? e->key.sa : e->key.da).addr());
+                    return ranges_overlap(ranges, a, a);
+                }))
+            {
+                erase_entry(it);
+                removed++;
+            }
+            else
+                it++;
+        }
 
-        // click_chatter("Table: %s, Packet: %s Now: %s Recent: %s", fval->ts.unparse().c_str(), p_ts.unparse().c_str(), Timestamp::now().unparse().c_str(), Timestamp::recent().unparse().c_str());
+        return removed;
+    }
 
-        if (is_expired(p_ts, fval->ts))
-            ret = 0;
+    Vector<FlowEntry *> entries;
 
-        if (_loop_avoidance && p->has_network_header())
-            if (fval->ttl != p->ip_header()->ip_ttl)
-                ret = 0;
+    for (auto it = _dst_index.begin(); it; it++)
+    {
+        uint32_t net = it.key() << 8;
+        if (!ranges_overlap(ranges, net, net | 0xFF))
+            continue;
 
-        if (ret == 1)
+        for (FlowEntry *e = it.value(); e; e = links(e)->dst_link.next)
         {
-            fval->ts = p_ts;
-#if FFT_DETAILED_STATS
-            fval->last = p_ts;
-            fval->packets += 1;
-            fval->bytes += p->length();
-#endif
+            uint32_t a = ntohl(e->key.da.addr());
+            if (ranges_overlap(ranges, a, a))
+                entries.push_back(e);
+        }
+    }
+
+    for (int i = 0; i < entries.size(); i++)
+        erase_entry(entries[i]);
+
+    return entries.size();
+}
+
+int
+FFT::remove_gateway(IPAddress gateway)
+{
+    FFT_LATENCY(LAT_REMOVE);
+    int removed = 0;
+
+    if (_listener)
+        _listener->gateway_removed(gateway);
+
+    if (_shm)
+    {
+        uint32_t gw = gateway.addr();
+        return _shm->remove_if([gw](const SharedFlowTable::Entry &e) { return e.gateway == gw; });
+    }
+
+    if (!_index)
+    {
+        auto it = _table.begin();
+
+        while (it)
+        {
+            if (release_matching(it.get(), [gateway](const FlowEntry *, int, const NextHop &nh) {
+                    return nh.gateway == gateway;
+                }))
+            {
+                erase_entry(it);
+                removed++;
+            }
+            else
+                it++;
         }
 
-        if (_gc_on_check)
-            bucket_garbage_collection(fkey, p_ts);
+        return removed;
     }
 
-    return ret;
+    for (int nh = 1; nh < _nexthops.size(); nh++)
+        if (_nexthops[nh].refs && _nexthops[nh].gateway == gateway)
+        {
+            FlowEntry *e;
+            while ((e = _nh_index.get(nh)))
+            {
+                erase_entry(e);
+                removed++;
+            }
+        }
+
+    return removed;
 }
 
+// Moves all flows with the given gateway to another gateway (and port, if
+// 'port' is not negative) by rewriting their next hops, entries are not
+// touched. Returns the number of rewritten next hops.
 int
-FFT::route_flow(Packet *p)
+FFT::reroute_gateway(IPAddress gateway, IPAddress new_gateway, int port)
 {
-    FlowKey fkey(p);
-    FlowValue *fval = _table.get_pointer(fkey);
+    int rerouted = 0;
 
-    if (fval)
+    if (_listener)
+        _listener->gateway_rerouted(gateway, new_gateway, port);
+
+    for (int nh = 1; nh < _nexthops.size(); nh++)
     {
-        uint8_t port = fval->port;
-        IPAddress gateway = fval->gateway;
-        if (gateway)
-            p->set_dst_ip_anno(gateway);
-        return port;
+        NextHop &n = _nexthops[nh];
+
+        if (!n.refs || n.gateway != gateway)
+            continue;
+
+        uint8_t new_port = port >= 0 ? port : n.port;
+
+        auto it = _nexthop_map.find(nexthop_key(n.gateway, n.port));
+        if (it && it.value() == nh)
+            _nexthop_map.erase(it);
+
+        // If the new next hop already exists, both are kept and new flows
+        // use the existing one
+        if (!_nexthop_map.get_pointer(nexthop_key(new_gateway, new_port)))
+            _nexthop_map.set(nexthop_key(new_gateway, new_port), nh);
+
+        if (_port_stats && new_port != n.port)
+        {
+            _ports[n.port].entries -= n.refs;
+            port_stats(new_port).entries += n.refs;
+        }
+
+        n.gateway = new_gateway;
+        n.port = new_port;
+        rerouted++;
     }
-    else
-        return -1;
+
+    return rerouted;
+}
+
+// Checks bounds of the adaptive timeout for the given target, TIMEOUT_MAX
+// defaults to TIMEOUT. Used by configure() and by handlers, which change
+// the target and the bounds at run time.
+int
+FFT::check_adapt(uint32_t target_size, uint32_t timeout_min, uint32_t &timeout_max,
+                 ErrorHandler *errh)
+{
+    if (!target_size)
+        return 0;
+    if (_shm_name)
+        return errh->error("TARGET_SIZE cannot be used with SHM, its size is fixed");
+    if (!timeout_max)
+        timeout_max = _timeout;
+    if (timeout_max == 0xFFFFFFFF)
+        return errh->error("TARGET_SIZE requires TIMEOUT or TIMEOUT_MAX");
+    if (timeout_min > timeout_max)
+        return errh->error("TIMEOUT_MIN is greater than TIMEOUT_MAX");
+    return 0;
 }
 
+// Above TARGET_SIZE, timeout is lowered in proportion to the excess and
+// expired entries are removed at once, so that memory stays bounded
+// during bursts. Below 3/4 of the target, it grows by a quarter, but not
+// beyond the value at which flows inserted at the current rate would fill
+// the table (Little's law: entries = insertion rate * timeout).
 void
-FFT::remove_flows(uint8_t port)
+FFT::run_timer(Timer *)
 {
-    auto it = _table.begin();
+    uint64_t size = _table.size();
+    uint64_t rate = (_inserted - _adapt_inserted) * 1000 / _adapt_interval;
+    uint64_t timeout = _timeout;
 
-    while (it)
+    _adapt_inserted = _inserted;
+    _adapt_timer.reschedule_after_msec(_adapt_interval);
+
+    if (size > _target_size)
+        timeout = timeout * _target_size / size;
+    else if (size < (uint64_t) _target_size * 3 / 4)
     {
-        if (it.value().port == port)
-            it = _table.erase(it);
-        else
-            it++;
+        uint64_t grown = timeout + timeout / 4 + 1;
+        uint64_t limit = rate ? (uint64_t) _target_size * 1000 / rate : grown;
+        timeout = grown < limit ? grown : (limit > timeout ? limit : timeout);
     }
+
+    if (timeout < _timeout_min)
+        timeout = _timeout_min;
+    if (timeout > _timeout_max)
+        timeout = _timeout_max;
+    _timeout = timeout;
+
+    if (size > _target_size)
+        global_garbage_collection();
+
+    TimeoutSample sample = { (uint32_t) Timestamp::now().msecval(), _timeout,
+                             (uint32_t) _table.size(), (uint32_t) rate };
+    if (_timeout_history.size() < TIMEOUT_HISTORY)
+        _timeout_history.push_back(sample);
+    else
+        _timeout_history[_history_pos] = sample;
+    _history_pos = (_history_pos + 1) % TIMEOUT_HISTORY;
 }
 
 void
 FFT::global_garbage_collection()
 {
-    Timestamp ts = Timestamp::now();
+    FFT_LATENCY(LAT_GLOBAL_GC);
+    uint32_t ts = Timestamp::now().msecval();
+
+    if (_shm)
+    {
+        uint32_t now = ts, timeout = _timeout;
+        _shm->remove_if([now, timeout](const SharedFlowTable::Entry &e) {
+            return SharedFlowTable::is_expired(now, e.ts, timeout);
+        });
+        return;
+    }
 
     auto it = _table.begin();
 
     while (it)
     {
-        if (is_expired(ts, it.value().ts))
-            it = _table.erase(it);
+        if (is_expired(ts, entry_ts(it.get())))
+            erase_entry(it);
         else
             it++;
     }
 }
 
 void
-FFT::bucket_garbage_collection(const FlowKey fkey, const Timestamp ts)
+FFT::bucket_garbage_collection(const FlowKey fkey, uint32_t ts)
 {
+    FFT_LATENCY(LAT_BUCKET_GC);
     auto it = _table.find_prefer(fkey);
 
     while (it)
     {
-        if (it.key().hashcode() % _table.bucket_count()
+        if (it->key.hashcode() % _table.bucket_count()
             != fkey.hashcode() % _table.bucket_count())
             break;
 
-        if (is_expired(ts, it.value().ts))
-            it = _table.erase(it);
+        if (is_expired(ts, entry_ts(it.get())))
+            erase_entry(it);
         else
             it++;
     }
@@ -221,8 +1733,11 @@ FFT::bucket_garbage_collection(const FlowKey fkey, const Timestamp ts)
 String
 FFT::dump_table(enum dumptype type)
 {
+    if (_shm)
+        return shm_dump_table(type);
+
     StringAccum sa;
-    Timestamp ts = Timestamp::now();
+    uint32_t ts = Timestamp::now().msecval();
 
 #if FFT_DETAILED_STATS
     if (type == ALL)
@@ -233,18 +1748,227 @@ FFT::dump_table(enum dumptype type)
 
     while (it)
     {
-        if (type == ALL || !is_expired(ts, it.value().ts))
+        FlowValue val = it->value;
+        val.ts = entry_ts(it.get());
+
+        // Directions of symmetric entries are printed as separate flows
+        if (type == ALL || !is_expired(ts, val.ts))
+            for (int dir = 0; dir < (_symmetric ? 2 : 1); dir++)
+            {
+                FlowKey key = it->key;
+                uint16_t nexthop = dir_nexthop(it.get(), dir);
+                if (_symmetric && !nexthop)
+                    continue;
+                if (dir)
+                    key.reverse();
+                print_flow_info(&sa, key, val, _nexthops[nexthop].port, ts);
+            }
+        it++;
+    }
+
+    return sa.take_string();
+}
+
+String
+FFT::shm_dump_table(enum dumptype type)
+{
+    StringAccum sa;
+    uint32_t now = Timestamp::now().msecval();
+
+    _shm->for_each([&](const SharedFlowTable::Entry &e) {
+        if (type == ALL || !SharedFlowTable::is_expired(now, e.ts, _timeout))
         {
-            print_flow_info(&sa, it.key(), it.value(), ts);
+            FlowKey key(IPAddress(e.key.sa), IPAddress(e.key.da), e.key.sp, e.key.dp);
+            key.h = e.key.hash;
+            FlowValue val = FlowValue();
+            val.ts = e.ts;
+            val.ttl = e.ttl;
+            print_flow_info(&sa, key, val, e.port, now);
         }
-        it++;
+    });
+
+    return sa.take_string();
+}
+
+#if FFT_LATENCY_STATS
+// One line per operation: name, number of samples and p50, p99, p99.9 and
+// maximum in cycles, histograms of all threads are merged
+String
+FFT::unparse_latency()
+{
+    static const char * const names[] = {
+        "add", "check", "route", "bucket_gc", "remove", "global_gc"
+    };
+    StringAccum sa;
+
+    for (int op = 0; op < LAT_NOPS; op++)
+    {
+        LatencyHistogram h;
+        for (unsigned i = 0; i < _latency.weight(); i++)
+            h.merge(_latency.get_value(i).hist[op]);
+        sa << names[op] << ' ' << h.count() << ' ' << h.percentile(50, 100) << ' '
+           << h.percentile(99, 100) << ' ' << h.percentile(999, 1000) << ' ' << h.max() << '\n';
+    }
+
+    return sa.take_string();
+}
+
+void
+FFT::reset_latency()
+{
+    for (unsigned i = 0; i < _latency.weight(); i++)
+        for (int op = 0; op < LAT_NOPS; op++)
+            _latency.get_value(i).hist[op].reset();
+}
+#endif
+
+// One line per sample from the oldest: milliseconds ago, effective timeout
+// in milliseconds, entries after the adjustment and insertions per second
+String
+FFT::unparse_timeout_history()
+{
+    StringAccum sa;
+    uint32_t now = Timestamp::now().msecval();
+    int n = _timeout_history.size();
+
+    for (int i = 0; i < n; i++)
+    {
+        const TimeoutSample &s = _timeout_history[n < TIMEOUT_HISTORY ? i : (_history_pos + i) % n];
+        sa << (int32_t) (now - s.ts) << ' ' << s.timeout << ' ' << s.size << ' '
+           << s.insert_rate << '\n';
+    }
+
+    return sa.take_string();
+}
+
+// One line per next hop in use: index, gateway, port and number of entries
+String
+FFT::unparse_nexthops()
+{
+    StringAccum sa;
+
+    for (int nh = 1; nh < _nexthops.size(); nh++)
+        if (_nexthops[nh].refs)
+            sa << nh << ' ' << _nexthops[nh].gateway << ' ' << (int) _nexthops[nh].port
+               << ' ' << _nexthops[nh].refs << '\n';
+
+    return sa.take_string();
+}
+
+// One line per port: port, entries, packet rate, byte rate and new flow rate
+String
+FFT::unparse_port_stats()
+{
+    StringAccum sa;
+
+    for (int port = 0; port < _ports.size(); port++)
+    {
+        PortStats &ps = _ports[port];
+        // Rates decay also when no packets are accounted to the port
+        ps.packet_rate.update(0);
+        ps.byte_rate.update(0);
+        ps.new_flow_rate.update(0);
+        sa << port << ' ' << ps.entries << ' ' << ps.packet_rate.unparse_rate() << ' '
+           << ps.byte_rate.unparse_rate() << ' ' << ps.new_flow_rate.unparse_rate() << '\n';
+    }
+
+    return sa.take_string();
+}
+
+static int
+hashcode_compar(const void *a, const void *b, void *)
+{
+    uint32_t ha = *(const uint32_t *) a;
+    uint32_t hb = *(const uint32_t *) b;
+    return ha < hb ? -1 : (ha > hb ? 1 : 0);
+}
+
+String
+FFT::hash_stats()
+{
+    if (_shm)
+    {
+        StringAccum sa;
+        sa << "hash " << _hash.type_name() << '\n'
+           << "entries " << _shm->size() << '\n'
+           << "buckets " << _shm->bucket_count() << '\n'
+           << "ways " << (int) SharedFlowTable::WAYS << '\n';
+        return sa.take_string();
+    }
+
+    uint32_t used_buckets = 0;
+    uint32_t max_chain = 0;
+    uint64_t chain_steps = 0;
+
+    for (uint32_t b = 0; b < _table.bucket_count(); b++)
+    {
+        uint32_t n = _table.bucket_size(b);
+        if (n)
+            used_buckets++;
+        if (n > max_chain)
+            max_chain = n;
+        // Entries compared on average by a successful lookup in this bucket
+        chain_steps += (uint64_t) n * (n + 1) / 2;
+    }
+
+    Vector<uint32_t> hashes;
+    hashes.reserve(_table.size());
+    for (auto it = _table.begin(); it; it++)
+        hashes.push_back(it->key.h);
+
+    uint32_t collisions = 0;
+    if (hashes.size())
+    {
+        click_qsort(hashes.begin(), hashes.size(), sizeof(uint32_t), hashcode_compar);
+        for (int i = 1; i < hashes.size(); i++)
+            if (hashes[i] == hashes[i - 1])
+                collisions++;
     }
 
+    StringAccum sa;
+    sa << "hash " << _hash.type_name() << '\n'
+       << "entries " << _table.size() << '\n'
+       << "buckets " << _table.bucket_count() << '\n'
+       << "used_buckets " << used_buckets << '\n'
+       << "max_chain " << max_chain << '\n';
+    // Averages in thousandths, floating point is not available in kernel
+    uint64_t avg_chain = used_buckets ? (uint64_t) _table.size() * 1000 / used_buckets : 0;
+    uint64_t avg_steps = _table.size() ? chain_steps * 1000 / _table.size() : 0;
+    sa.snprintf(64, "avg_chain %u.%03u\n", (unsigned) (avg_chain / 1000), (unsigned) (avg_chain % 1000));
+    sa.snprintf(64, "avg_lookup_steps %u.%03u\n", (unsigned) (avg_steps / 1000), (unsigned) (avg_steps % 1000));
+    sa << "hash_collisions " << collisions << '\n';
+    return sa.take_string();
+}
+
+String
+FFT::hot_stats()
+{
+    uint32_t used = 0;
+
+    for (uint32_t i = 0; _hot && i <= _hot_mask; i++)
+        for (int w = 0; w < HOT_WAYS; w++)
+            if (_hot[i].slot[w].entry)
+                used++;
+
+    uint64_t lookups = _hot_hits + _hot_misses;
+    uint64_t hit_rate = lookups ? _hot_hits * 1000 / lookups : 0;
+
+    StringAccum sa;
+    sa << "slots " << _hot_size << '\n'
+       << "ways " << (int) HOT_WAYS << '\n'
+       << "used " << used << '\n'
+       << "hits " << _hot_hits << '\n'
+       << "misses " << _hot_misses << '\n';
+    sa.snprintf(64, "hit_rate %u.%03u\n", (unsigned) (hit_rate / 1000), (unsigned) (hit_rate % 1000));
     return sa.take_string();
 }
 
 enum { H_SIZE, H_BUCKET_COUNT, H_MAX_BUCKET_SIZE, H_ACTIVE,
-       H_ALL, H_CLEAR, H_REMOVE, H_MANUAL_GC };
+       H_ALL, H_HASH_STATS, H_HOT_STATS, H_ARENA, H_ADMITTED, H_REJECTED_GLOBAL, H_REJECTED_LOCAL,
+       H_DEFERRED, H_REPINNED, H_BULK_RECORDS, H_BULK_APPLIED, H_TIMEOUT_HISTORY, H_PORT_STATS,
+       H_NEXTHOPS, H_LATENCY, H_CLEAR, H_REMOVE, H_REMOVE_PREFIX,
+       H_REMOVE_GATEWAY, H_REROUTE, H_BULK, H_MANUAL_GC, H_RESET_LATENCY, H_TARGET_SIZE,
+       H_TIMEOUT_MIN, H_TIMEOUT_MAX };
 
 String
 FFT::read_handler(Element *e, void *thunk)
@@ -253,11 +1977,14 @@ FFT::read_handler(Element *e, void *thunk)
     switch ((intptr_t) thunk)
     {
         case H_SIZE:
-            return String(cft->_table.size());
+            return String(cft->size());
         case H_BUCKET_COUNT:
-            return String(cft->_table.bucket_count());
+            return String(cft->_shm ? cft->_shm->bucket_count() : cft->_table.bucket_count());
         case H_MAX_BUCKET_SIZE:
         {
+            if (cft->_shm)
+                return String((int) SharedFlowTable::WAYS);
+
             unsigned int max_bucket_size = 0;
 
             for (unsigned int b = 0; b < cft->_table.bucket_count(); b++)
@@ -270,23 +1997,50 @@ FFT::read_handler(Element *e, void *thunk)
             return cft->dump_table(ACTIVE);
         case H_ALL:
             return cft->dump_table(ALL);
+        case H_HASH_STATS:
+            return cft->hash_stats();
+        case H_HOT_STATS:
+            return cft->hot_stats();
+        case H_ARENA:
+            return cft->_arena.stats();
+        case H_ADMITTED:
+            return String(cft->_admitted);
+        case H_REJECTED_GLOBAL:
+            return String(cft->_rejected_global);
+        case H_REJECTED_LOCAL:
+            return String(cft->_rejected_local);
+        case H_DEFERRED:
+            return String(cft->_deferred);
+        case H_REPINNED:
+            return String(cft->_repinned);
+        case H_BULK_RECORDS:
+            return String(cft->_bulk_records);
+        case H_BULK_APPLIED:
+            return String(cft->_bulk_applied);
+        case H_TIMEOUT_HISTORY:
+            return cft->unparse_timeout_history();
+        case H_PORT_STATS:
+            return cft->unparse_port_stats();
+        case H_NEXTHOPS:
+            return cft->unparse_nexthops();
+#if FFT_LATENCY_STATS
+        case H_LATENCY:
+            return cft->unparse_latency();
+#endif
         default:
             return "<error>";
     }
 }
 
 int
-FFT::write_handler(const String &data, Element *e, void *thunk, ErrorHandler *)
+FFT::write_handler(const String &data, Element *e, void *thunk, ErrorHandler *errh)
 {
     FFT *cft = (FFT *) e;
     switch ((intptr_t) thunk)
     {
         case H_CLEAR:
         {
-#if FFT_DETAILED_STATS
-            cft->_overwritten_flows.clear();
-#endif
-            cft->_table.clear();
+            cft->clear();
             return 0;
         }
         case H_REMOVE:
@@ -296,11 +2050,96 @@ FFT::write_handler(const String &data, Element *e, void *thunk, ErrorHandler *)
                 cft->remove_flows(port);
             return 0;
         }
+        case H_REMOVE_PREFIX:
+        {
+            IPAddress addr, mask;
+            if (!IPPrefixArg(true).parse(data, addr, mask, ArgContext(e)))
+                return errh->error("expected IP prefix");
+            cft->remove_prefix(addr, mask);
+            return 0;
+        }
+        case H_REMOVE_GATEWAY:
+        {
+            IPAddress gateway;
+            if (!IPAddressArg().parse(data, gateway, ArgContext(e)))
+                return errh->error("expected IP address");
+            cft->remove_gateway(gateway);
+            return 0;
+        }
+        case H_REROUTE:
+        {
+            Vector<String> words;
+            IPAddress gateway, new_gateway;
+            int port = -1;
+            cp_spacevec(data, words);
+            if (cft->_shm)
+                return errh->error("reroute is not supported with SHM");
+            if (words.size() < 2 || words.size() > 3
+                || !IPAddressArg().parse(words[0], gateway, ArgContext(e))
+                || !IPAddressArg().parse(words[1], new_gateway, ArgContext(e))
+                || (words.size() == 3 && (!IntArg().parse(words[2], port) || port < 0 || port > 255)))
+                return errh->error("expected GATEWAY NEW_GATEWAY [PORT]");
+            cft->reroute_gateway(gateway, new_gateway, port);
+            return 0;
+        }
+        case H_BULK:
+        {
+            if (data.length() % sizeof(BulkRecord))
+                return errh->error("data length is not a multiple of %d", (int) sizeof(BulkRecord));
+            // Handler data need not be aligned
+            Vector<BulkRecord> records(data.length() / sizeof(BulkRecord), BulkRecord());
+            if (records.size())
+                memcpy(records.begin(), data.data(), data.length());
+            int applied = cft->apply_bulk(records.begin(), records.size(), errh);
+            return applied < 0 ? applied : 0;
+        }
         case H_MANUAL_GC:
         {
             cft->global_garbage_collection();
             return 0;
         }
+        case H_TARGET_SIZE:
+        case H_TIMEOUT_MIN:
+        case H_TIMEOUT_MAX:
+        {
+            unsigned int value;
+            if (!cp_integer(cp_uncomment(data), &value))
+                return errh->error("expected non-negative integer");
+
+            uint32_t target = cft->_target_size;
+            uint32_t timeout_min = cft->_timeout_min;
+            uint32_t timeout_max = cft->_timeout_max;
+            if ((intptr_t) thunk == H_TARGET_SIZE)
+                target = value;
+            else if ((intptr_t) thunk == H_TIMEOUT_MIN)
+                timeout_min = value;
+            else
+                timeout_max = value;
+
+            if (cft->check_adapt(target, timeout_min, timeout_max, errh) < 0)
+                return -1;
+
+            cft->_target_size = target;
+            cft->_timeout_min = timeout_min;
+            cft->_timeout_max = timeout_max;
+
+            // Target 0 pauses the controller, the timeout is kept
+            if (!target)
+                cft->_adapt_timer.unschedule();
+            else if (!cft->_adapt_timer.scheduled())
+            {
+                cft->_adapt_inserted = cft->_inserted;
+                cft->_adapt_timer.schedule_after_msec(cft->_adapt_interval);
+            }
+            return 0;
+        }
+#if FFT_LATENCY_STATS
+        case H_RESET_LATENCY:
+        {
+            cft->reset_latency();
+            return 0;
+        }
+#endif
         default:
             return -1;
     }
@@ -314,10 +2153,38 @@ FFT::add_handlers()
     add_read_handler("max_bucket_size", read_handler, H_MAX_BUCKET_SIZE);
     add_read_handler("active", read_handler, H_ACTIVE);
     add_read_handler("all", read_handler, H_ALL);
+    add_read_handler("hash_stats", read_handler, H_HASH_STATS);
+    add_read_handler("hot_stats", read_handler, H_HOT_STATS);
+    add_read_handler("arena", read_handler, H_ARENA);
+    add_read_handler("admitted", read_handler, H_ADMITTED);
+    add_read_handler("rejected_global", read_handler, H_REJECTED_GLOBAL);
+    add_read_handler("rejected_local", read_handler, H_REJECTED_LOCAL);
+    add_read_handler("deferred", read_handler, H_DEFERRED);
+    add_read_handler("repinned", read_handler, H_REPINNED);
+    add_read_handler("bulk_records", read_handler, H_BULK_RECORDS);
+    add_read_handler("bulk_applied", read_handler, H_BULK_APPLIED);
+    add_read_handler("timeout_history", read_handler, H_TIMEOUT_HISTORY);
+    add_read_handler("port_stats", read_handler, H_PORT_STATS);
+    add_read_handler("nexthops", read_handler, H_NEXTHOPS);
     add_write_handler("clear", write_handler, H_CLEAR, Handler::BUTTON);
     add_write_handler("remove", write_handler, H_REMOVE);
+    add_write_handler("remove_prefix", write_handler, H_REMOVE_PREFIX);
+    add_write_handler("remove_gateway", write_handler, H_REMOVE_GATEWAY);
+    add_write_handler("reroute", write_handler, H_REROUTE);
+    add_write_handler("bulk", write_handler, H_BULK, Handler::RAW);
     add_write_handler("manual_gc", write_handler, H_MANUAL_GC, Handler::BUTTON);
+#if FFT_LATENCY_STATS
+    add_read_handler("latency", read_handler, H_LATENCY);
+    add_write_handler("reset_latency", write_handler, H_RESET_LATENCY, Handler::BUTTON);
+    add_data_handlers("latency_sample", Handler::OP_READ | Handler::OP_WRITE, &_latency_sample);
+#endif
     add_data_handlers("timeout", Handler::OP_READ | Handler::OP_WRITE, &_timeout);
+    add_data_handlers("timeout_min", Handler::OP_READ, &_timeout_min);
+    add_data_handlers("timeout_max", Handler::OP_READ, &_timeout_max);
+    add_data_handlers("target_size", Handler::OP_READ, &_target_size);
+    add_write_handler("timeout_min", write_handler, H_TIMEOUT_MIN);
+    add_write_handler("timeout_max", write_handler, H_TIMEOUT_MAX);
+    add_write_handler("target_size", write_handler, H_TARGET_SIZE);
     add_data_handlers("loop_avoidance", Handler::OP_READ | Handler::OP_WRITE
                       | Handler::CHECKBOX, &_loop_avoidance);
     add_data_handlers("gc_on_add", Handler::OP_READ | Handler::OP_WRITE
@@ -326,12 +2193,13 @@ FFT::add_handlers()
                       | Handler::CHECKBOX, &_gc_on_check);
 }
 
+// Timestamps wrap around, so entries older than 24 days are expired
+// regardless of timeout
 inline bool
-FFT::is_expired(const Timestamp p_ts, const Timestamp fft_ts)
+FFT::is_expired(uint32_t ts, uint32_t fft_ts)
 {
-    Timestamp diff = p_ts - fft_ts;
-    Timestamp::value_type diff_msec = diff.msecval();
-    if (diff_msec < 0 || diff_msec > _timeout)
+    int32_t diff_msec = ts - fft_ts;
+    if (diff_msec < 0 || (uint32_t) diff_msec > _timeout)
         return true;
     else
         return false;
@@ -339,28 +2207,29 @@ FFT::is_expired(const Timestamp p_ts, const Timestamp fft_ts)
 
 void
 FFT::print_flow_info(StringAccum *sa, const FlowKey &key, const FlowValue &val,
-                     const Timestamp ts)
+                     uint8_t port, uint32_t ts)
 {
 #if FFT_DETAILED_STATS
-    sa->snprintf(256, "%08lx %s %u %s %u %u %ld %s %s %u %llu\n",
+    sa->snprintf(256, "%08lx %s %u %s %u %u %d %s %s %u %llu\n",
                  key.hashcode() % _table.bucket_count(),
                  key.sa.unparse().c_str(), ntohs(key.sp),
                  key.da.unparse().c_str(), ntohs(key.dp),
-                 val.port,
-                 (ts - val.ts).msecval(),
+                 port,
+                 (int32_t) (ts - val.ts),
                  val.first.unparse().c_str(),
                  val.last.unparse().c_str(),
                  val.packets,
                  val.bytes);
 #else
-    sa->snprintf(256, "%08lx %s:%u -> %s:%u Port: %u Last pkt: %ld ms ago\n",
+    sa->snprintf(256, "%08lx %s:%u -> %s:%u Port: %u Last pkt: %d ms ago\n",
                  key.hashcode() % _table.bucket_count(),
                  key.sa.unparse().c_str(), ntohs(key.sp),
                  key.da.unparse().c_str(), ntohs(key.dp),
-                 val.port,
-                 (ts - val.ts).msecval());
+                 port,
+                 (int32_t) (ts - val.ts));
 #endif
 }
 
 CLICK_ENDDECLS
+ELEMENT_REQUIRES(FlowArena FlowHash SharedFlowTable)
 EXPORT_ELEMENT(FFT)
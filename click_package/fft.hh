@@ -1,11 +1,49 @@
 #ifndef FFT_HH
 #define FFT_HH
 #include <click/element.hh>
+#include <click/ewma.hh>
+#include <click/hashcontainer.hh>
 #include <click/hashtable.hh>
 #include <click/straccum.hh>
+#include <click/timer.hh>
+#include <click/tokenbucket.hh>
+#if HAVE_BATCH
+# include <click/packetbatch.hh>
+#endif
+#include "flowarena.hh"
+#include "flowhash.hh"
+#include "shmflowtable.hh"
 CLICK_DECLS
 
 #define FFT_DETAILED_STATS 0
+#define FFT_LATENCY_STATS 0
+
+#if FFT_LATENCY_STATS
+# include <click/cycles.hh>
+# include <click/multithread.hh>
+# include "latencyhistogram.hh"
+#endif
+
+// Receives changes of FFT contents, used for replication of the table.
+// Flows added by packets (and refreshed periodically, see set_listener())
+// are reported individually, removals are reported as operations.
+class FFTListener
+{
+    public:
+
+        virtual ~FFTListener() {}
+
+        virtual void flow_added(IPAddress src_addr, IPAddress dst_addr, uint16_t src_port,
+                                uint16_t dst_port, uint8_t proto, IPAddress gateway,
+                                uint8_t port, uint8_t ttl) = 0;
+        virtual void flow_removed(IPAddress src_addr, IPAddress dst_addr, uint16_t src_port,
+                                  uint16_t dst_port, uint8_t proto) = 0;
+        virtual void port_removed(uint8_t port) = 0;
+        virtual void prefix_removed(IPAddress addr, IPAddress mask) = 0;
+        virtual void gateway_removed(IPAddress gateway) = 0;
+        virtual void gateway_rerouted(IPAddress gateway, IPAddress new_gateway, int port) = 0;
+        virtual void cleared() = 0;
+};
 
 class FFT : public Element
 {
@@ -21,13 +59,120 @@ class FFT : public Element
         void cleanup(CleanupStage);
         void add_handlers();
 
-        int add_flow(Packet *, uint8_t port);
+        void run_timer(Timer *);
+
+        // Run of consecutive packets of the same flow in a batch. Table is
+        // accessed once for the whole run, using the key of the first packet.
+        struct PacketRun
+        {
+            Packet *first;
+            Packet *last;
+            uint32_t count;
+            uint64_t bytes;
+        };
+
+        // Insertion of a flow prepared from a packet run by make_insert(),
+        // so that it can be applied to the table later (AddFFT with QUEUE).
+        // Key is already hashed, addresses and ports are in network byte
+        // order and the timestamp is in milliseconds.
+        struct Insert
+        {
+            uint32_t src_addr;
+            uint32_t dst_addr;
+            uint16_t src_port;
+            uint16_t dst_port;
+            uint32_t hash;
+            uint32_t gateway;
+            uint32_t ts;
+            uint32_t count;
+            uint64_t bytes;
+            uint8_t port;
+            uint8_t ttl;
+            uint8_t dir;
+#if FFT_DETAILED_STATS
+            Timestamp first;
+            Timestamp last;
+#endif
+        };
+
+        int add_flow(Packet *, uint8_t port, TokenBucket *limiter = NULL);
+        int add_flow(const PacketRun &, uint8_t port, TokenBucket *limiter = NULL);
+        void make_insert(const PacketRun &, uint8_t port, Insert &);
+        int add_flow(const Insert &, TokenBucket *limiter = NULL);
+        void add_flows(const Insert *, int n, TokenBucket *limiter, int *results);
         int add_flow(IPAddress src_addr, IPAddress dst_addr, uint16_t src_port, uint16_t dst_port,
-                     Timestamp ts, IPAddress gateway, uint8_t port, uint8_t ttl, bool overwrite_existing);
+                     Timestamp ts, IPAddress gateway, uint8_t port, uint8_t ttl, bool overwrite_existing,
+                     uint8_t proto = 0);
         int check_flow(Packet *);
         int route_flow(Packet *);
+        int check_route_flow(Packet *);
+        int check_flow(const PacketRun &);
+        int route_flow(const PacketRun &);
+        int check_route_flow(const PacketRun &);
+
+#if HAVE_BATCH
+        template <typename F> inline void for_each_run(PacketBatch *, F function);
+        template <typename F, typename O> inline void classify_runs(PacketBatch *, int nbatches,
+                                                                    F classify, O on_finish);
+#endif
+
+        // Record of bulk flow programming (handler 'bulk', FFTControl), all
+        // fields in network byte order. TTL 0 matches the TTL of the first
+        // packet of the flow.
+        struct BulkRecord
+        {
+            uint8_t op;
+            uint8_t port;
+            uint8_t ttl;
+            uint8_t proto;
+            uint32_t src_addr;
+            uint32_t dst_addr;
+            uint16_t src_port;
+            uint16_t dst_port;
+            uint32_t gateway;
+        };
+
+        enum BulkOp
+        {
+            BULK_ADD = 1, BULK_MODIFY, BULK_REMOVE
+        };
+
+        int apply_bulk(const BulkRecord *, int n, ErrorHandler *);
 
+        void clear();
+        int remove_flow(IPAddress src_addr, IPAddress dst_addr, uint16_t src_port, uint16_t dst_port,
+                        uint8_t proto = 0);
         void remove_flows(uint8_t port);
+        int remove_prefix(IPAddress addr, IPAddress mask);
+
+        // Range of destination addresses (host byte order, inclusive)
+        struct AddressRange
+        {
+            uint32_t first;
+            uint32_t last;
+        };
+
+        int remove_ranges(const Vector<AddressRange> &);
+        int remove_gateway(IPAddress gateway);
+        int reroute_gateway(IPAddress gateway, IPAddress new_gateway, int port = -1);
+
+        int set_listener(FFTListener *, uint32_t refresh_period, ErrorHandler *);
+
+        // Elements accessing the table on the packet path register in their
+        // configure(), so that AddFFT with QUEUE can check their threads
+        void add_user(Element *e) { _users.push_back(e); }
+        const Vector<Element *> &users() const { return _users; }
+
+        // Fields identifying a flow: destination address, address pair,
+        // addresses and ports, or addresses, ports and protocol
+        enum KeyType
+        {
+            KEY_DST, KEY_PAIR, KEY_4TUPLE, KEY_5TUPLE
+        };
+
+        KeyType key_type() const { return _key_type; }
+        bool symmetric() const { return _symmetric; }
+        size_t size() const { return _shm ? _shm->size() : _table.size(); }
 
     private:
 
@@ -37,8 +182,9 @@ class FFT : public Element
             IPAddress da;
             uint16_t sp;
             uint16_t dp;
+            uint32_t h;
 
-            FlowKey() : sa(), da(), sp(0), dp(0) {}
+            FlowKey() : sa(), da(), sp(0), dp(0), h(0) {}
 
             FlowKey(IPAddress src_addr, IPAddress dst_addr, uint16_t src_port, uint16_t dst_port)
             {
@@ -48,54 +194,72 @@ class FFT : public Element
                 dp = dst_port;
             }
 
-            FlowKey(Packet *p)
+            // Fields not covered by the key type are zero. With KEY_5TUPLE,
+            // 'h' holds the protocol until FFT::hash_key() is called.
+            FlowKey(Packet *p, KeyType type)
             {
                 const click_ip *iph = p->ip_header();
 
-                sa = IPAddress(iph->ip_src);
+                sa = type != KEY_DST ? IPAddress(iph->ip_src) : IPAddress();
                 da = IPAddress(iph->ip_dst);
+                sp = 0;
+                dp = 0;
+                h = type == KEY_5TUPLE ? iph->ip_p : 0;
 
-                if (IP_FIRSTFRAG(iph) && (iph->ip_p == IP_PROTO_TCP || iph->ip_p == IP_PROTO_UDP))
+                if (type >= KEY_4TUPLE && IP_FIRSTFRAG(iph)
+                    && (iph->ip_p == IP_PROTO_TCP || iph->ip_p == IP_PROTO_UDP))
                 {
                     sp = *((const uint16_t *) (p->transport_header()));
                     dp = *((const uint16_t *) (p->transport_header() + 2));
                 }
-                else
-                {
-                    sp = 0;
-                    dp = 0;
-                }
             }
 
+            inline void
+            normalize(KeyType type, uint8_t proto)
+            {
+                if (type == KEY_DST)
+                    sa = IPAddress();
+                if (type < KEY_4TUPLE)
+                    sp = dp = 0;
+                h = type == KEY_5TUPLE ? proto : 0;
+            }
+
+            inline void
+            reverse()
+            {
+                IPAddress a = sa;
+                uint16_t p = sp;
+                sa = da;
+                sp = dp;
+                da = a;
+                dp = p;
+            }
+
+            // Hash is computed once by FFT::hash_key() and stored in the key
             inline hashcode_t
             hashcode() const
             {
-                uint32_t a = ((uint32_t) sa * 59) ^ (uint32_t) da;
-                a = a ^ sp ^ (dp << 16);
-                // Bob Jenkins http://burtleburtle.net/bob/hash/integer.html
-                a = (a + 0x7ed55d16) + (a << 12);
-                a = (a ^ 0xc761c23c) ^ (a >> 19);
-                a = (a + 0x165667b1) + (a << 5);
-                a = (a + 0xd3a2646c) ^ (a << 9);
-                a = (a + 0xfd7046c5) + (a << 3);
-                a = (a ^ 0xb55a4f09) ^ (a >> 16);
-                return a;
+                return h;
             }
 
+            // Equal keys have equal hashes, so comparing the hash is safe,
+            // and it covers the protocol of KEY_5TUPLE keys
             inline bool
             operator==(const FlowKey &b) const
             {
                 return sa == b.sa && da == b.da
-                    && sp == b.sp && dp == b.dp;
+                    && sp == b.sp && dp == b.dp && h == b.h;
             }
         };
 
+        // Gateway and port are stored in the next hop table, timestamp is in
+        // milliseconds and wraps around
         struct FlowValue
         {
-            Timestamp ts;
-            IPAddress gateway;
-            uint8_t port;
+            uint32_t ts;
+            uint16_t nexthop;
             uint8_t ttl;
+            uint8_t epoch;
 #if FFT_DETAILED_STATS
             Timestamp first;
             Timestamp last;
@@ -104,19 +268,330 @@ class FFT : public Element
 #endif
         };
 
+        struct FlowEntry;
+
+        struct IndexLink
+        {
+            FlowEntry *next;
+            FlowEntry **pprev;
+        };
+
+        struct FlowEntry
+        {
+            typedef FlowKey key_type;
+            typedef const FlowKey &key_const_reference;
+
+            FlowKey key;
+            FlowValue value;
+            FlowEntry *_hashnext;
+
+            FlowEntry(const FlowKey &k) : key(k), value(), _hashnext(NULL) {}
+
+            key_const_reference hashkey() const { return key; }
+        };
+
+        // Links in secondary indexes are allocated right after the entry,
+        // only if INDEX is set
+        struct IndexLinks
+        {
+            IndexLink dst_link;
+            IndexLink nh_link;
+        };
+
+        // Next hop and TTL of the reverse direction of a symmetric entry,
+        // allocated right after the entry only if SYMMETRIC is set. Key
+        // and value hold the forward direction, timestamp is shared.
+        struct ReverseValue
+        {
+            uint16_t nexthop;
+            uint8_t ttl;
+        };
+
+        // Entries with the same gateway and port share one next hop, index 0
+        // is used by entries which were not assigned any yet
+        struct NextHop
+        {
+            IPAddress gateway;
+            uint8_t port;
+            uint32_t refs;
+        };
+
+        enum { MAX_NEXTHOPS = 65536 };
+
         uint32_t _timeout;
+        KeyType _key_type;
+        bool _symmetric;
         bool _loop_avoidance;
+        bool _rss_udp;
         bool _gc_on_add;
         bool _gc_on_check;
 
-        HashTable<FlowKey, FlowValue> _table;
+        // Adaptive timeout, enabled by TARGET_SIZE: effective timeout is
+        // adjusted between TIMEOUT_MIN and TIMEOUT_MAX once per
+        // ADAPT_INTERVAL, the last samples are kept in a ring
+        struct TimeoutSample
+        {
+            uint32_t ts;
+            uint32_t timeout;
+            uint32_t size;
+            uint32_t insert_rate;
+        };
+
+        enum { TIMEOUT_HISTORY = 64 };
+
+        uint32_t _timeout_min;
+        uint32_t _timeout_max;
+        uint32_t _target_size;
+        uint32_t _adapt_interval;
+        uint64_t _inserted;
+        uint64_t _adapt_inserted;
+        Vector<TimeoutSample> _timeout_history;
+        int _history_pos;
+        Timer _adapt_timer;
+
+        uint32_t _new_flow_rate;
+        uint32_t _new_flow_burst;
+        TokenBucket _new_flow_bucket;
+        uint64_t _admitted;
+        uint64_t _rejected_global;
+        uint64_t _rejected_local;
+
+        // Doorkeeper: two Bloom filters of flows seen in the current and the
+        // previous period, so that a flow is admitted only with its second
+        // packet. Enabled by DOORKEEPER.
+        uint32_t _doorkeeper_bits;
+        uint32_t _doorkeeper_period;
+        uint32_t _doorkeeper_mask;
+        uint64_t *_doorkeeper[2];
+        int _doorkeeper_cur;
+        uint32_t _doorkeeper_start;
+        uint64_t _deferred;
+
+        // Existing entries of flows added again (expired or with different
+        // TTL), so the flows could have been moved to another route
+        uint64_t _repinned;
+
+        uint64_t _bulk_records;
+        uint64_t _bulk_applied;
+
+        FlowHash _hash;
+
+        uint32_t _arena_prealloc;
+        uint32_t _arena_reserve;
+        bool _hugepages;
+        int _numa_node;
+
+        HashContainer<FlowEntry> _table;
+        FlowArena _arena;
+
+        Vector<NextHop> _nexthops;
+        Vector<uint16_t> _free_nexthops;
+        HashTable<uint64_t, uint16_t> _nexthop_map;
+
+        // Table in named shared memory used instead of _table if SHM is set
+        String _shm_name;
+        uint32_t _shm_size;
+        SharedFlowTable *_shm;
+
+        // Per-port number of entries and EWMA rates of packets, bytes and
+        // new flows, maintained only if PORT_STATS is set
+        struct PortStats
+        {
+            uint32_t entries;
+            RateEWMA packet_rate;
+            RateEWMA byte_rate;
+            RateEWMA new_flow_rate;
+
+            PortStats() : entries(0) {}
+        };
+
+        bool _port_stats;
+        Vector<PortStats> _ports;
+
+        // Small set-associative cache of recently hit entries in front of
+        // _table, enabled by HOT_SIZE. Slots hold copies of the key and the
+        // value, so hits do not touch the entry. Refreshed timestamps (and
+        // learned TTL) are written back only when the slot is evicted or
+        // flushed. Only the top byte of the hash is kept (it holds the
+        // protocol of KEY_5TUPLE keys), the set is selected by the low bits,
+        // so a slot takes 32 bytes and a set one cache line.
+        struct HotSlot
+        {
+            uint32_t sa;
+            uint32_t da;
+            uint16_t sp;
+            uint16_t dp;
+            uint32_t ts;
+            FlowEntry *entry;
+            uint16_t nexthop;
+            uint16_t rev_nexthop;
+            uint8_t ttl;
+            uint8_t rev_ttl;
+            uint8_t epoch;
+            uint8_t h_top;
+
+            inline uint16_t &dir_nexthop(int dir) { return dir ? rev_nexthop : nexthop; }
+            inline uint8_t &dir_ttl(int dir) { return dir ? rev_ttl : ttl; }
+        };
+
+        // Slots of a set are ordered from the most recently used
+        enum { HOT_WAYS = 2 };
+
+        struct HotSet
+        {
+            HotSlot slot[HOT_WAYS];
+        };
+
+        static_assert(sizeof(void *) != 8 || sizeof(HotSet) == 64,
+                      "hot set must fit in one cache line");
+
+        uint32_t _hot_size;
+        uint32_t _hot_mask;
+        HotSet *_hot;
+        void *_hot_mem;
+        size_t _hot_mem_size;
+        uint64_t _hot_hits;
+        uint64_t _hot_misses;
+
+        // Secondary indexes of entries by destination /24 network and by
+        // next hop, maintained only if INDEX is set
+        bool _index;
+        HashTable<uint32_t, FlowEntry *> _dst_index;
+        HashTable<uint16_t, FlowEntry *> _nh_index;
 
 #if FFT_DETAILED_STATS
         StringAccum _overwritten_flows;
 #endif
 
+        // Active flows are reported to the listener again, when they are hit
+        // in a refresh period different from 'epoch' of the entry
+        FFTListener *_listener;
+        uint32_t _refresh_period;
+
+        Vector<Element *> _users;
+
+        inline uint8_t refresh_epoch(uint32_t ts) const { return ts / _refresh_period; }
+        inline void notify_added(FlowEntry *, int dir);
+
+        // Every LATENCY_SAMPLE-th operation of each type is timed
+        uint32_t _latency_sample;
+
+#if FFT_LATENCY_STATS
+        enum LatencyOp
+        {
+            LAT_ADD, LAT_CHECK, LAT_ROUTE, LAT_BUCKET_GC, LAT_REMOVE, LAT_GLOBAL_GC, LAT_NOPS
+        };
+
+        struct LatencyStats
+        {
+            uint32_t calls[LAT_NOPS];
+            LatencyHistogram hist[LAT_NOPS];
+
+            LatencyStats() { memset(calls, 0, sizeof(calls)); }
+        };
+
+        // Times the enclosing scope if the operation is sampled
+        class LatencyScope
+        {
+            public:
+
+                inline LatencyScope(FFT *fft, LatencyOp op) : _stats(NULL), _op(op)
+                {
+                    if (fft->_latency_sample)
+                    {
+                        LatencyStats &ls = *fft->_latency;
+                        if (++ls.calls[op] >= fft->_latency_sample)
+                        {
+                            ls.calls[op] = 0;
+                            _stats = &ls;
+                            _start = click_get_cycles();
+                        }
+                    }
+                }
+
+                inline ~LatencyScope()
+                {
+                    if (_stats)
+                        _stats->hist[_op].record(click_get_cycles() - _start);
+                }
+
+            private:
+
+                LatencyStats *_stats;
+                LatencyOp _op;
+                click_cycles_t _start;
+        };
+
+        per_thread<LatencyStats> _latency;
+
+        String unparse_latency();
+        void reset_latency();
+#endif
+
+        inline bool rss_ports(const Packet *);
+        inline int hash_key(FlowKey &, const Packet *);
+        template <typename V> inline bool refresh_value(const PacketRun &, FlowEntry *, V &,
+                                                        int dir, uint16_t nexthop, uint8_t &ttl);
+        uint16_t check_entry(const PacketRun &);
+        static inline void set_gateway_anno(const PacketRun &, IPAddress);
+        String hash_stats();
+        String unparse_timeout_history();
+        int check_adapt(uint32_t target_size, uint32_t timeout_min, uint32_t &timeout_max,
+                        ErrorHandler *);
+
+        FlowEntry *find_insert(const FlowKey &, const Insert *ins = NULL,
+                               TokenBucket *limiter = NULL, int *status = NULL);
+        inline int admit_flow(const FlowKey &, const Insert *ins, TokenBucket *limiter);
+        inline bool doorkeeper_pass(uint32_t h, const Insert &);
+        static inline FlowKey insert_key(const Insert &);
+        int insert_flow(const Insert &, TokenBucket *limiter, bool gc);
+        void doorkeeper_rotate(uint32_t now);
+        inline void erase_entry(HashContainer<FlowEntry>::iterator &);
+        void erase_entry(FlowEntry *);
+        int get_nexthop(IPAddress gateway, uint8_t port);
+        void put_nexthop(uint16_t);
+        inline void set_nexthop(FlowEntry *, int dir, uint16_t);
+        inline bool update_nexthop(FlowEntry *, int dir, IPAddress gateway, uint8_t port);
+        inline bool has_nexthop(FlowEntry *);
+        template <typename M> inline bool release_matching(FlowEntry *, M match);
+        inline void release_entry(FlowEntry *);
+        String unparse_nexthops();
+        inline PortStats &port_stats(uint8_t port);
+        inline void account(uint8_t port, uint32_t packets, uint64_t bytes);
+        String unparse_port_stats();
+
+        static inline IndexLinks *links(FlowEntry *e) { return (IndexLinks *) (e + 1); }
+        // INDEX is not used with SYMMETRIC, so reverse value takes place of
+        // the links
+        static inline ReverseValue *reverse_value(FlowEntry *e) { return (ReverseValue *) (e + 1); }
+        static inline uint16_t &dir_nexthop(FlowEntry *e, int dir)
+        {
+            return dir ? reverse_value(e)->nexthop : e->value.nexthop;
+        }
+        static inline uint8_t &dir_ttl(FlowEntry *e, int dir)
+        {
+            return dir ? reverse_value(e)->ttl : e->value.ttl;
+        }
+        static inline void index_link(FlowEntry *&head, FlowEntry *, IndexLink IndexLinks::*);
+        static inline bool index_unlink(FlowEntry *, IndexLink IndexLinks::*);
+        inline void index_remove(FlowEntry *);
+        void clear_table();
+
+        inline HotSet &hot_set(uint32_t h) { return _hot[h & _hot_mask]; }
+        inline HotSlot *hot_find(const FlowKey &);
+        inline HotSlot *hot_slot(const FlowEntry *);
+        inline void hot_promote(FlowEntry *);
+        inline void hot_flush(FlowEntry *);
+        inline uint32_t entry_ts(const FlowEntry *);
+        String hot_stats();
+
+        static inline SharedFlowTable::Key shm_key(const FlowKey &);
+        int shm_check(Packet *, IPAddress &gateway);
+        int shm_add_flow(const FlowKey &, uint32_t ts, IPAddress gateway, uint8_t port, uint8_t ttl,
+                         bool overwrite_existing, const Insert *ins, TokenBucket *limiter);
+
         void global_garbage_collection();
-        void bucket_garbage_collection(const FlowKey, const Timestamp);
+        void bucket_garbage_collection(const FlowKey, uint32_t ts);
 
         enum dumptype
         {
@@ -124,14 +599,95 @@ class FFT : public Element
         };
 
         String dump_table(enum dumptype);
+        String shm_dump_table(enum dumptype);
 
         static String read_handler(Element *, void *);
         static int write_handler(const String &, Element *, void *, ErrorHandler *);
 
-        bool is_expired(const Timestamp, const Timestamp);
+        inline bool is_expired(uint32_t ts, uint32_t fft_ts);
         void print_flow_info(StringAccum *, const FlowKey &, const FlowValue &,
-                             const Timestamp);
+                             uint8_t port, uint32_t ts);
 };
 
+#if HAVE_BATCH
+// Runs are split also on TTL change if loop avoidance is enabled, as TTL
+// is compared with the entry
+template <typename F> inline void
+FFT::for_each_run(PacketBatch *batch, F function)
+{
+    PacketRun run;
+    FlowKey key;
+    uint8_t ttl = 0;
+    Packet *p = batch->first();
+
+    run.first = NULL;
+
+    while (p)
+    {
+        Packet *next = p->next();
+        FlowKey k(p, _key_type);
+        uint8_t t = _loop_avoidance ? p->ip_header()->ip_ttl : 0;
+
+        if (run.first && k == key && t == ttl)
+        {
+            run.last = p;
+            run.count++;
+            run.bytes += p->length();
+        }
+        else
+        {
+            if (run.first)
+                function((const PacketRun &) run);
+            run.first = run.last = p;
+            run.count = 1;
+            run.bytes = p->length();
+            key = k;
+            ttl = t;
+        }
+
+        p = next;
+    }
+
+    if (run.first)
+        function((const PacketRun &) run);
+}
+
+// Whole runs are appended to the batch of the output returned by 'classify'
+template <typename F, typename O> inline void
+FFT::classify_runs(PacketBatch *batch, int nbatches, F classify, O on_finish)
+{
+    Packet *head_array[nbatches];
+    Packet *tail_array[nbatches];
+    unsigned count_array[nbatches];
+    Packet **head = head_array, **tail = tail_array;
+    unsigned *count = count_array;
+
+    for (int o = 0; o < nbatches; o++)
+    {
+        head[o] = NULL;
+        count[o] = 0;
+    }
+
+    for_each_run(batch, [&](const PacketRun &run) {
+        int o = classify(run);
+        if (o < 0 || o >= nbatches)
+            o = nbatches - 1;
+        if (head[o])
+            tail[o]->set_next(run.first);
+        else
+            head[o] = run.first;
+        tail[o] = run.last;
+        count[o] += run.count;
+    });
+
+    for (int o = 0; o < nbatches; o++)
+        if (head[o])
+        {
+            tail[o]->set_next(NULL);
+            on_finish(o, PacketBatch::make_from_simple_list(head[o], tail[o], count[o]));
+        }
+}
+#endif
+
 CLICK_ENDDECLS
 #endif
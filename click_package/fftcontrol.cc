@@ -0,0 +1,169 @@
+#include <click/config.h>
+
+#include "fftcontrol.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+CLICK_DECLS
+
+FFTControl::FFTControl() :
+    _table(NULL), _verbose(false), _fd(-1), _buf(NULL),
+    _batches(0), _records(0), _applied(0), _errors(0)
+{
+}
+
+FFTControl::~FFTControl()
+{
+}
+
+int
+FFTControl::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    if (Args(conf, this, errh)
+        .read_mp("TABLE", ElementCastArg("FFT"), _table)
+        .read_mp("PATH", FilenameArg(), _path)
+        .read("VERBOSE", _verbose)
+        .complete() < 0)
+        return -1;
+
+    if (_path.length() >= (int) sizeof(((struct sockaddr_un *) 0)->sun_path))
+        return errh->error("PATH is too long");
+
+    return 0;
+}
+
+int
+FFTControl::initialize(ErrorHandler *errh)
+{
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    memcpy(sun.sun_path, _path.data(), _path.length());
+
+    _fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (_fd < 0)
+        return errh->error("socket: %s", strerror(errno));
+    fcntl(_fd, F_SETFL, O_NONBLOCK);
+
+    unlink(_path.c_str());
+    if (bind(_fd, (struct sockaddr *) &sun, sizeof(sun)) < 0)
+        return errh->error("bind %s: %s", _path.c_str(), strerror(errno));
+
+    int size = 4 << 20;
+    setsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    _buf = new unsigned char[MAX_DATAGRAM];
+    add_select(_fd, SELECT_READ);
+    return 0;
+}
+
+void
+FFTControl::cleanup(CleanupStage)
+{
+    if (_fd >= 0)
+    {
+        remove_select(_fd, SELECT_READ);
+        close(_fd);
+        unlink(_path.c_str());
+    }
+    delete[] _buf;
+}
+
+// Returns the number of applied records or -1 if the batch is malformed
+// or rejected by FFT
+int
+FFTControl::process(const unsigned char *data, int len, uint32_t &seq)
+{
+    const Header *h = (const Header *) data;
+
+    if (len < (int) sizeof(Header) || ntohl(h->magic) != MAGIC || ntohs(h->version) != VERSION
+        || len != (int) (sizeof(Header) + ntohs(h->count) * sizeof(FFT::BulkRecord)))
+        return -1;
+
+    seq = ntohl(h->seq);
+
+    ErrorHandler *errh = _verbose ? ErrorHandler::default_handler() : ErrorHandler::silent_handler();
+    int n = ntohs(h->count);
+    int applied = _table->apply_bulk((const FFT::BulkRecord *) (h + 1), n, errh);
+
+    if (applied >= 0)
+    {
+        _records += n;
+        _applied += applied;
+    }
+
+    return applied;
+}
+
+// Batches are applied in the thread of this element, between batches of
+// packets processed by this thread
+void
+FFTControl::selected(int fd, int)
+{
+    struct sockaddr_un from;
+    socklen_t from_len;
+    ssize_t len;
+
+    while (from_len = sizeof(from),
+           (len = recvfrom(fd, _buf, MAX_DATAGRAM, 0, (struct sockaddr *) &from, &from_len)) >= 0)
+    {
+        uint32_t seq = 0;
+        int result = process(_buf, len, seq);
+
+        _batches++;
+        if (result < 0)
+            _errors++;
+
+        if (_verbose)
+            click_chatter("%s: batch %u: %d", name().c_str(), seq, result);
+
+        // Reply only to senders with a bound address
+        if (from_len > sizeof(sa_family_t))
+        {
+            Reply r;
+            r.magic = htonl(MAGIC);
+            r.version = htons(VERSION);
+            r.reserved = 0;
+            r.seq = htonl(seq);
+            r.result = htonl(result);
+            sendto(fd, &r, sizeof(r), MSG_DONTWAIT, (struct sockaddr *) &from, from_len);
+        }
+    }
+}
+
+enum { H_BATCHES, H_RECORDS, H_APPLIED, H_ERRORS };
+
+String
+FFTControl::read_handler(Element *e, void *thunk)
+{
+    FFTControl *fc = (FFTControl *) e;
+    switch ((intptr_t) thunk)
+    {
+        case H_BATCHES:
+            return String(fc->_batches);
+        case H_RECORDS:
+            return String(fc->_records);
+        case H_APPLIED:
+            return String(fc->_applied);
+        case H_ERRORS:
+            return String(fc->_errors);
+        default:
+            return "<error>";
+    }
+}
+
+void
+FFTControl::add_handlers()
+{
+    add_read_handler("batches", read_handler, H_BATCHES);
+    add_read_handler("records", read_handler, H_RECORDS);
+    add_read_handler("applied", read_handler, H_APPLIED);
+    add_read_handler("errors", read_handler, H_ERRORS);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel)
+EXPORT_ELEMENT(FFTControl)
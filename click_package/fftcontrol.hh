@@ -0,0 +1,66 @@
+#ifndef FFTCONTROL_HH
+#define FFTCONTROL_HH
+#include <click/element.hh>
+#include "fft.hh"
+CLICK_DECLS
+
+class FFTControl : public Element
+{
+    public:
+
+        FFTControl();
+        ~FFTControl();
+
+        const char *class_name() const { return "FFTControl"; }
+        const char *port_count() const { return PORTS_0_0; }
+
+        int configure(Vector<String> &conf, ErrorHandler *);
+        int initialize(ErrorHandler *);
+        void cleanup(CleanupStage);
+        void add_handlers();
+
+        void selected(int fd, int mask);
+
+    private:
+
+        enum { MAGIC = 0x46465443, VERSION = 1, MAX_DATAGRAM = 65536 };
+
+        // Request is followed by 'count' FFT::BulkRecord records, reply
+        // carries the number of applied records or -1 if the batch was
+        // rejected. All fields in network byte order.
+        struct Header
+        {
+            uint32_t magic;
+            uint16_t version;
+            uint16_t count;
+            uint32_t seq;
+        };
+
+        struct Reply
+        {
+            uint32_t magic;
+            uint16_t version;
+            uint16_t reserved;
+            uint32_t seq;
+            int32_t result;
+        };
+
+        FFT *_table;
+        String _path;
+        bool _verbose;
+
+        int _fd;
+        unsigned char *_buf;
+
+        uint64_t _batches;
+        uint64_t _records;
+        uint64_t _applied;
+        uint64_t _errors;
+
+        int process(const unsigned char *data, int len, uint32_t &seq);
+
+        static String read_handler(Element *, void *);
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,299 @@
+#include <click/config.h>
+
+#include "fftfastpath.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/packet_anno.hh>
+#include <click/straccum.hh>
+#include <clicknet/ether.h>
+#include <clicknet/ip.h>
+
+#include "packet_info.hh"
+CLICK_DECLS
+
+FFTFastPath::FFTFastPath() :
+    _paint(-1), _mtu(1500), _timeout(10000), _verbose(false),
+    _hits(0), _misses(0), _learned(0), _changed(0)
+{
+}
+
+FFTFastPath::~FFTFastPath()
+{
+}
+
+int
+FFTFastPath::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    if (Args(conf, this, errh)
+        .read_mp("ETH", EtherAddressArg(), _eth)
+        .read("PAINT", _paint)
+        .read("MTU", _mtu)
+        .read("TIMEOUT", SecondsArg(3), _timeout)
+        .read("VERBOSE", _verbose)
+        .complete() < 0)
+        return -1;
+
+    if (_paint > 255)
+        return errh->error("PAINT must be between 0 and 255");
+    if (_mtu < sizeof(click_ip))
+        return errh->error("MTU is too small");
+
+    return 0;
+}
+
+int
+FFTFastPath::initialize(ErrorHandler *)
+{
+    return 0;
+}
+
+// Returns the MAC address of the next hop, or an empty address if it is
+// unknown or expired. Address is returned by value, as learn() may grow
+// the table and move its entries. Entries are not removed when they
+// expire, the number of entries is bounded by the next hops resolved by
+// ARPQuerier.
+inline EtherAddress
+FFTFastPath::lookup(IPAddress gw, uint32_t now)
+{
+    const MacEntry *m = _macs.get_pointer(gw);
+
+    if (!m || (uint32_t) (now - m->ts) > _timeout)
+        return EtherAddress();
+    return m->mac;
+}
+
+// Packet can take the fast path only if the full chain would just
+// decrement its TTL and encapsulate it: it is not a link level broadcast
+// (DropBroadcasts), is not leaving through the interface it came from
+// (PaintTee), has no options (IPGWOptions), was not generated by
+// ICMPError (FixIPSrc), does not expire (DecIPTTL) and fits the MTU
+// (IPFragmenter)
+inline bool
+FFTFastPath::eligible(Packet *p)
+{
+    if (!p->has_network_header() || p->network_header_offset() != 0)
+        return false;
+
+    const click_ip *iph = p->ip_header();
+
+    return iph->ip_hl == 5 && iph->ip_ttl > 1 && p->length() <= _mtu
+        && p->packet_type_anno() != Packet::BROADCAST
+        && p->packet_type_anno() != Packet::MULTICAST
+        && (_paint < 0 || PAINT_ANNO(p) != _paint)
+        && !FIX_IP_SRC_ANNO(p);
+}
+
+// TTL decrement with incremental checksum update (as in DecIPTTL) and
+// Ethernet header write in one pass over the packet. Returns NULL if the
+// packet could not be made writable, it is freed in that case.
+inline Packet *
+FFTFastPath::forward(Packet *p, const EtherAddress &dst)
+{
+    WritablePacket *q = p->push(sizeof(click_ether));
+
+    if (!q)
+        return NULL;
+
+    click_ip *iph = q->ip_header();
+    iph->ip_ttl--;
+    uint32_t sum = (~ntohs(iph->ip_sum) & 0xFFFF) + 0xFEFF;
+    iph->ip_sum = ~htons(sum + (sum >> 16));
+
+    click_ether *ethh = reinterpret_cast<click_ether *>(q->data());
+    memcpy(ethh->ether_dhost, dst.data(), 6);
+    memcpy(ethh->ether_shost, _eth.data(), 6);
+    ethh->ether_type = htons(ETHERTYPE_IP);
+    q->set_mac_header(q->data(), sizeof(click_ether));
+
+    return q;
+}
+
+// Returns output of the packet, which may be replaced, or -1 if it was
+// freed. Next hop found last is reused by following packets of a batch,
+// which are usually routed to the same gateway.
+inline int
+FFTFastPath::process(Packet *&p, IPAddress &last_gw, EtherAddress &last)
+{
+    IPAddress gw = p->dst_ip_anno();
+
+    if (!last || gw != last_gw)
+    {
+        last_gw = gw;
+        last = lookup(gw, p->timestamp_anno().msecval());
+    }
+
+    if (!last || !eligible(p))
+    {
+        if (_verbose)
+            click_chatter("%s: %s slow path", name().c_str(), packet_info(p).c_str());
+        _misses++;
+        return 1;
+    }
+
+    _hits++;
+    p = forward(p, last);
+    return p ? 0 : -1;
+}
+
+// Frames of the full chain carry the destination MAC resolved by
+// ARPQuerier for their next hop (destination IP annotation)
+inline void
+FFTFastPath::learn(Packet *p)
+{
+    if (p->length() < sizeof(click_ether) || !p->dst_ip_anno())
+        return;
+
+    const click_ether *ethh = reinterpret_cast<const click_ether *>(p->data());
+
+    if (ethh->ether_type != htons(ETHERTYPE_IP) || (ethh->ether_dhost[0] & 1))
+        return;
+
+    EtherAddress mac(ethh->ether_dhost);
+    MacEntry &m = _macs[p->dst_ip_anno()];
+
+    if (!m.mac)
+        _learned++;
+    else if (m.mac != mac)
+    {
+        _changed++;
+        if (_verbose)
+            click_chatter("%s: %s moved from %s to %s", name().c_str(),
+                          p->dst_ip_anno().unparse().c_str(), m.mac.unparse_colon().c_str(),
+                          mac.unparse_colon().c_str());
+    }
+
+    m.mac = mac;
+    m.ts = p->timestamp_anno().msecval();
+}
+
+void
+FFTFastPath::push(int port, Packet *p)
+{
+    if (port == 1)
+    {
+        learn(p);
+        output(0).push(p);
+        return;
+    }
+
+    IPAddress last_gw;
+    EtherAddress last;
+    int o = process(p, last_gw, last);
+
+    if (o >= 0)
+        output(o).push(p);
+}
+
+#if HAVE_BATCH
+void
+FFTFastPath::push_batch(int port, PacketBatch *batch)
+{
+    if (port == 1)
+    {
+        FOR_EACH_PACKET(batch, p)
+            learn(p);
+        output_push_batch(0, batch);
+        return;
+    }
+
+    Packet *head[2] = { NULL, NULL };
+    Packet *tail[2] = { NULL, NULL };
+    unsigned count[2] = { 0, 0 };
+    IPAddress last_gw;
+    EtherAddress last;
+    Packet *p = batch->first();
+
+    while (p)
+    {
+        Packet *next = p->next();
+        int o = process(p, last_gw, last);
+
+        if (o >= 0)
+        {
+            if (head[o])
+                tail[o]->set_next(p);
+            else
+                head[o] = p;
+            tail[o] = p;
+            count[o]++;
+        }
+
+        p = next;
+    }
+
+    for (int o = 0; o < 2; o++)
+        if (head[o])
+        {
+            tail[o]->set_next(NULL);
+            output_push_batch(o, PacketBatch::make_from_simple_list(head[o], tail[o], count[o]));
+        }
+}
+#endif
+
+// One line per next hop: address, MAC and milliseconds since it was learned
+String
+FFTFastPath::unparse_macs()
+{
+    StringAccum sa;
+    uint32_t now = Timestamp::now().msecval();
+
+    for (auto it = _macs.begin(); it; it++)
+        sa << it.key() << ' ' << it.value().mac.unparse_colon() << ' '
+           << (int32_t) (now - it.value().ts) << '\n';
+
+    return sa.take_string();
+}
+
+enum { H_HITS, H_MISSES, H_LEARNED, H_CHANGED, H_MACS, H_FLUSH };
+
+String
+FFTFastPath::read_handler(Element *e, void *thunk)
+{
+    FFTFastPath *fp = (FFTFastPath *) e;
+    switch ((intptr_t) thunk)
+    {
+        case H_HITS:
+            return String(fp->_hits);
+        case H_MISSES:
+            return String(fp->_misses);
+        case H_LEARNED:
+            return String(fp->_learned);
+        case H_CHANGED:
+            return String(fp->_changed);
+        case H_MACS:
+            return fp->unparse_macs();
+        default:
+            return "<error>";
+    }
+}
+
+int
+FFTFastPath::write_handler(const String &, Element *e, void *thunk, ErrorHandler *)
+{
+    FFTFastPath *fp = (FFTFastPath *) e;
+    switch ((intptr_t) thunk)
+    {
+        case H_FLUSH:
+        {
+            fp->_macs.clear();
+            return 0;
+        }
+        default:
+            return -1;
+    }
+}
+
+void
+FFTFastPath::add_handlers()
+{
+    add_read_handler("hits", read_handler, H_HITS);
+    add_read_handler("misses", read_handler, H_MISSES);
+    add_read_handler("learned", read_handler, H_LEARNED);
+    add_read_handler("changed", read_handler, H_CHANGED);
+    add_read_handler("macs", read_handler, H_MACS);
+    add_write_handler("flush", write_handler, H_FLUSH, Handler::BUTTON);
+    add_data_handlers("timeout", Handler::OP_READ | Handler::OP_WRITE, &_timeout);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(FFTFastPath)
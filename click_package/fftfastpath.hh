@@ -0,0 +1,63 @@
+#ifndef FFTFASTPATH_HH
+#define FFTFASTPATH_HH
+#include <click/batchelement.hh>
+#include <click/etheraddress.hh>
+#include <click/hashtable.hh>
+CLICK_DECLS
+
+class FFTFastPath : public BatchElement
+{
+    public:
+
+        FFTFastPath();
+        ~FFTFastPath();
+
+        const char *class_name() const { return "FFTFastPath"; }
+        const char *port_count() const { return "2/2"; }
+        const char *processing() const { return PUSH; }
+
+        int configure(Vector<String> &conf, ErrorHandler *);
+        int initialize(ErrorHandler *);
+        void add_handlers();
+
+        void push(int, Packet *);
+    #if HAVE_BATCH
+        void push_batch (int, PacketBatch *);
+    #endif
+
+    private:
+
+        // Destination MAC of a next hop, learned from frames leaving
+        // ARPQuerier, timestamp is in milliseconds
+        struct MacEntry
+        {
+            EtherAddress mac;
+            uint32_t ts;
+        };
+
+        EtherAddress _eth;
+        int _paint;
+        uint32_t _mtu;
+        uint32_t _timeout;
+        bool _verbose;
+
+        HashTable<IPAddress, MacEntry> _macs;
+
+        uint64_t _hits;
+        uint64_t _misses;
+        uint64_t _learned;
+        uint64_t _changed;
+
+        inline EtherAddress lookup(IPAddress, uint32_t now);
+        inline bool eligible(Packet *);
+        inline Packet *forward(Packet *, const EtherAddress &);
+        inline int process(Packet *&, IPAddress &last_gw, EtherAddress &last);
+        inline void learn(Packet *);
+        String unparse_macs();
+
+        static String read_handler(Element *, void *);
+        static int write_handler(const String &, Element *, void *, ErrorHandler *);
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,550 @@
+#include <click/config.h>
+
+#include "fftsync.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/straccum.hh>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+CLICK_DECLS
+
+FFTSync::FFTSync() :
+    _table(NULL), _interval(10), _rate(100000), _refresh(1000), _max_pending(1000000),
+    _verbose(false), _send_fd(-1), _recv_fd(-1), _recv_family(0), _peer_len(0), _timer(this),
+    _tx_seq(0), _rx_seq(0), _applying(-1),
+    _sent_records(0), _sent_packets(0), _dropped(0), _send_errors(0),
+    _received_records(0), _received_packets(0), _lost_packets(0), _bad_packets(0),
+    _rejected_packets(0)
+{
+}
+
+FFTSync::~FFTSync()
+{
+}
+
+int
+FFTSync::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    if (Args(conf, this, errh)
+        .read_mp("TABLE", ElementCastArg("FFT"), _table)
+        .read("PEER", StringArg(), _peer_name)
+        .read("LISTEN", StringArg(), _listen_name)
+        .read("ALLOW", _allow)
+        .read("INTERVAL", SecondsArg(3), _interval)
+        .read("RATE", _rate)
+        .read("REFRESH", SecondsArg(3), _refresh)
+        .read("MAX_PENDING", _max_pending)
+        .read("VERBOSE", _verbose)
+        .complete() < 0)
+        return -1;
+
+    if (!_peer_name && !_listen_name)
+        return errh->error("at least one of PEER and LISTEN must be set");
+    if (!_interval || !_rate)
+        return errh->error("INTERVAL and RATE must be positive");
+
+    _tb.assign(_rate, _rate);
+    return 0;
+}
+
+// Endpoint is 'unix:PATH' or '[udp:]ADDRESS:PORT'
+int
+FFTSync::parse_endpoint(const String &s, struct sockaddr_storage &ss, socklen_t &len,
+                        String &path, ErrorHandler *errh)
+{
+    memset(&ss, 0, sizeof(ss));
+
+    if (s.starts_with("unix:"))
+    {
+        struct sockaddr_un *sun = (struct sockaddr_un *) &ss;
+        path = s.substring(5);
+        if (!path || path.length() >= (int) sizeof(sun->sun_path))
+            return errh->error("bad socket path '%s'", path.c_str());
+        sun->sun_family = AF_UNIX;
+        memcpy(sun->sun_path, path.data(), path.length());
+        len = sizeof(struct sockaddr_un);
+        return AF_UNIX;
+    }
+
+    String addr = s.starts_with("udp:") ? s.substring(4) : s;
+    int colon = addr.find_right(':');
+    IPAddress ip;
+    int port;
+
+    if (colon < 0 || !IPAddressArg().parse(addr.substring(0, colon), ip)
+        || !IntArg().parse(addr.substring(colon + 1), port) || port < 0 || port > 65535)
+        return errh->error("bad endpoint '%s', expected unix:PATH or ADDRESS:PORT", s.c_str());
+
+    struct sockaddr_in *sin = (struct sockaddr_in *) &ss;
+    sin->sin_family = AF_INET;
+    sin->sin_addr = ip.in_addr();
+    sin->sin_port = htons(port);
+    len = sizeof(struct sockaddr_in);
+    path = String();
+    return AF_INET;
+}
+
+int
+FFTSync::initialize(ErrorHandler *errh)
+{
+    if (_listen_name)
+    {
+        struct sockaddr_storage ss;
+        socklen_t len;
+        String path;
+        int family = parse_endpoint(_listen_name, ss, len, path, errh);
+        if (family < 0)
+            return -1;
+
+        // Datagrams change the whole table, so UDP senders are restricted
+        // to ALLOW, by default the UDP PEER, or the loopback
+        if (family == AF_INET && !_allow)
+        {
+            struct sockaddr_storage peer;
+            socklen_t peer_len;
+            String peer_path;
+            const struct sockaddr_in *sin = (const struct sockaddr_in *) &ss;
+
+            if (_peer_name && parse_endpoint(_peer_name, peer, peer_len, peer_path, errh) == AF_INET)
+                _allow = IPAddress(((const struct sockaddr_in *) &peer)->sin_addr);
+            else if ((ntohl(sin->sin_addr.s_addr) >> 24) == 127)
+                _allow = IPAddress(htonl(0x7F000001));
+            else
+                return errh->error("ALLOW is required with UDP LISTEN on a non-loopback address");
+        }
+
+        _recv_family = family;
+        _recv_fd = socket(family, SOCK_DGRAM, 0);
+        if (_recv_fd < 0)
+            return errh->error("socket: %s", strerror(errno));
+        fcntl(_recv_fd, F_SETFL, O_NONBLOCK);
+
+        if (path)
+            unlink(path.c_str());
+        if (bind(_recv_fd, (struct sockaddr *) &ss, len) < 0)
+            return errh->error("bind %s: %s", _listen_name.c_str(), strerror(errno));
+        _unlink_path = path;
+
+        int size = 4 << 20;
+        setsockopt(_recv_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        add_select(_recv_fd, SELECT_READ);
+    }
+
+    if (_peer_name)
+    {
+        String path;
+        int family = parse_endpoint(_peer_name, _peer, _peer_len, path, errh);
+        if (family < 0)
+            return -1;
+
+        _send_fd = socket(family, SOCK_DGRAM, 0);
+        if (_send_fd < 0)
+            return errh->error("socket: %s", strerror(errno));
+        fcntl(_send_fd, F_SETFL, O_NONBLOCK);
+
+        if (_table->set_listener(this, _refresh, errh) < 0)
+            return -1;
+
+        _tb.set_full();
+        _timer.initialize(this);
+        _timer.schedule_after_msec(_interval);
+    }
+
+    return 0;
+}
+
+void
+FFTSync::cleanup(CleanupStage)
+{
+    if (_timer.initialized())
+        _table->set_listener(NULL, 0, ErrorHandler::default_handler());
+    if (_send_fd >= 0)
+        close(_send_fd);
+    if (_recv_fd >= 0)
+    {
+        remove_select(_recv_fd, SELECT_READ);
+        close(_recv_fd);
+    }
+    if (_unlink_path)
+        unlink(_unlink_path.c_str());
+}
+
+void
+FFTSync::flow_added(IPAddress src_addr, IPAddress dst_addr, uint16_t src_port,
+                    uint16_t dst_port, uint8_t proto, IPAddress gateway, uint8_t port,
+                    uint8_t ttl)
+{
+    if (applying())
+        return;
+
+    SyncKey key = { src_addr.addr(), dst_addr.addr(), src_port, dst_port, proto };
+
+    _lock.acquire();
+    Record *r = _pending.get_pointer(key);
+
+    if (!r && _pending.size() >= _max_pending)
+        _dropped++;
+    else
+    {
+        if (!r)
+            r = &_pending[key];
+
+        r->type = R_ADD;
+        r->port = port;
+        r->ttl = ttl;
+        r->flags = proto;
+        r->a = key.sa;
+        r->b = key.da;
+        r->c = key.sp;
+        r->d = key.dp;
+        r->e = gateway.addr();
+    }
+    _lock.release();
+}
+
+inline void
+FFTSync::push_op(const Record &r)
+{
+    if (_ops.size() >= (int) _max_pending)
+        _dropped++;
+    else
+        _ops.push_back(r);
+}
+
+// Pending additions affected by an operation are dropped or updated, as
+// operations are sent before additions. Called with _lock held.
+
+void
+FFTSync::flow_removed(IPAddress src_addr, IPAddress dst_addr, uint16_t src_port,
+                      uint16_t dst_port, uint8_t proto)
+{
+    if (applying())
+        return;
+
+    SyncKey key = { src_addr.addr(), dst_addr.addr(), src_port, dst_port, proto };
+    Record r = { R_REMOVE_FLOW, 0, 0, proto, key.sa, key.da, src_port, dst_port, 0 };
+
+    _lock.acquire();
+    _pending.erase(key);
+    push_op(r);
+    _lock.release();
+}
+
+void
+FFTSync::port_removed(uint8_t port)
+{
+    if (applying())
+        return;
+
+    Record r = { R_REMOVE_PORT, port, 0, 0, 0, 0, 0, 0, 0 };
+
+    _lock.acquire();
+    for (auto it = _pending.begin(); it; )
+        if (it.value().port == port)
+            it = _pending.erase(it);
+        else
+            it++;
+    push_op(r);
+    _lock.release();
+}
+
+void
+FFTSync::prefix_removed(IPAddress addr, IPAddress mask)
+{
+    if (applying())
+        return;
+
+    Record r = { R_REMOVE_PREFIX, 0, 0, 0, addr.addr(), mask.addr(), 0, 0, 0 };
+
+    _lock.acquire();
+    for (auto it = _pending.begin(); it; )
+        if ((it.value().b & mask.addr()) == addr.addr())
+            it = _pending.erase(it);
+        else
+            it++;
+    push_op(r);
+    _lock.release();
+}
+
+void
+FFTSync::gateway_removed(IPAddress gateway)
+{
+    if (applying())
+        return;
+
+    Record r = { R_REMOVE_GATEWAY, 0, 0, 0, gateway.addr(), 0, 0, 0, 0 };
+
+    _lock.acquire();
+    for (auto it = _pending.begin(); it; )
+        if (it.value().e == gateway.addr())
+            it = _pending.erase(it);
+        else
+            it++;
+    push_op(r);
+    _lock.release();
+}
+
+void
+FFTSync::gateway_rerouted(IPAddress gateway, IPAddress new_gateway, int port)
+{
+    if (applying())
+        return;
+
+    Record r = { R_REROUTE, (uint8_t) (port >= 0 ? port : 0), 0, (uint8_t) (port >= 0),
+                 gateway.addr(), new_gateway.addr(), 0, 0, 0 };
+
+    _lock.acquire();
+    for (auto it = _pending.begin(); it; it++)
+        if (it.value().e == gateway.addr())
+        {
+            it.value().e = new_gateway.addr();
+            if (port >= 0)
+                it.value().port = port;
+        }
+    push_op(r);
+    _lock.release();
+}
+
+void
+FFTSync::cleared()
+{
+    if (applying())
+        return;
+
+    Record r = { R_CLEAR, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    _lock.acquire();
+    _pending.clear();
+    _ops.clear();
+    push_op(r);
+    _lock.release();
+}
+
+// Sends as many records as the token bucket allows, operations first.
+// Records over the limit stay pending for the next flush. Records are taken
+// under the lock and sent after it is released, so threads writing the FFT
+// do not wait for the socket. Records of a datagram which fails to be sent
+// are dropped, as active flows are reported again after the refresh period
+// anyway.
+void
+FFTSync::flush()
+{
+    unsigned char buf[MAX_DATAGRAM];
+    Header *h = (Header *) buf;
+    Record *records = (Record *) (h + 1);
+    int op = 0;
+
+    _out.clear();
+
+    _lock.acquire();
+    _tb.fill();
+
+    for (; op < _ops.size() && _tb.remove_if(1); op++)
+        _out.push_back(_ops[op]);
+
+    if (op == _ops.size())
+    {
+        _ops.clear();
+        for (auto it = _pending.begin(); it && _tb.remove_if(1); )
+        {
+            _out.push_back(it.value());
+            it = _pending.erase(it);
+        }
+    }
+    else if (op)
+        _ops.erase(_ops.begin(), _ops.begin() + op);
+    _lock.release();
+
+    uint64_t dropped = 0;
+
+    for (int i = 0; i < _out.size(); )
+    {
+        int n = 0;
+
+        for (; i < _out.size() && n < MAX_RECORDS; i++)
+            records[n++] = _out[i];
+
+        h->magic = htonl(MAGIC);
+        h->version = htons(VERSION);
+        h->count = htons(n);
+        h->seq = htonl(_tx_seq++);
+
+        size_t len = sizeof(Header) + n * sizeof(Record);
+        if (sendto(_send_fd, buf, len, 0, (struct sockaddr *) &_peer, _peer_len) < 0)
+        {
+            _send_errors++;
+            dropped += n;
+            if (_verbose)
+                click_chatter("%s: sendto: %s", name().c_str(), strerror(errno));
+        }
+        else
+        {
+            _sent_records += n;
+            _sent_packets++;
+        }
+    }
+
+    if (dropped)
+    {
+        _lock.acquire();
+        _dropped += dropped;
+        _lock.release();
+    }
+}
+
+void
+FFTSync::run_timer(Timer *)
+{
+    flush();
+    _timer.reschedule_after_msec(_interval);
+}
+
+void
+FFTSync::selected(int fd, int)
+{
+    unsigned char buf[MAX_DATAGRAM + 1];
+    struct sockaddr_storage from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len;
+
+    while ((len = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *) &from, &from_len)) >= 0)
+    {
+        if (_recv_family == AF_INET
+            && (from.ss_family != AF_INET
+                || IPAddress(((struct sockaddr_in *) &from)->sin_addr) != _allow))
+        {
+            _rejected_packets++;
+            if (_verbose)
+                click_chatter("%s: datagram from unexpected sender rejected", name().c_str());
+        }
+        else
+            receive(buf, len);
+        from_len = sizeof(from);
+    }
+}
+
+void
+FFTSync::receive(const unsigned char *data, int len)
+{
+    const Header *h = (const Header *) data;
+
+    if (len < (int) sizeof(Header) || ntohl(h->magic) != MAGIC || ntohs(h->version) != VERSION
+        || len != (int) (sizeof(Header) + ntohs(h->count) * sizeof(Record)))
+    {
+        _bad_packets++;
+        return;
+    }
+
+    uint32_t seq = ntohl(h->seq);
+    if (_received_packets && (int32_t) (seq - _rx_seq) > 0)
+        _lost_packets += seq - _rx_seq;
+    _rx_seq = seq + 1;
+    _received_packets++;
+
+    const Record *records = (const Record *) (h + 1);
+    int n = ntohs(h->count);
+
+    _applying = click_current_cpu_id();
+    for (int i = 0; i < n; i++)
+        apply(records[i]);
+    _applying = -1;
+
+    _received_records += n;
+}
+
+void
+FFTSync::apply(const Record &r)
+{
+    switch (r.type)
+    {
+        case R_ADD:
+            _table->add_flow(IPAddress(r.a), IPAddress(r.b), r.c, r.d, Timestamp::now(),
+                             IPAddress(r.e), r.port, r.ttl, true, r.flags);
+            break;
+        case R_REMOVE_PORT:
+            _table->remove_flows(r.port);
+            break;
+        case R_REMOVE_PREFIX:
+            _table->remove_prefix(IPAddress(r.a), IPAddress(r.b));
+            break;
+        case R_REMOVE_GATEWAY:
+            _table->remove_gateway(IPAddress(r.a));
+            break;
+        case R_REROUTE:
+            _table->reroute_gateway(IPAddress(r.a), IPAddress(r.b), r.flags ? r.port : -1);
+            break;
+        case R_CLEAR:
+            _table->clear();
+            break;
+        case R_REMOVE_FLOW:
+            _table->remove_flow(IPAddress(r.a), IPAddress(r.b), r.c, r.d, r.flags);
+            break;
+        default:
+            _bad_packets++;
+            break;
+    }
+
+    if (_verbose)
+        click_chatter("%s: applied record type %d", name().c_str(), r.type);
+}
+
+enum { H_PENDING, H_SENT_RECORDS, H_SENT_PACKETS, H_DROPPED, H_SEND_ERRORS,
+       H_RECEIVED_RECORDS, H_RECEIVED_PACKETS, H_LOST_PACKETS, H_BAD_PACKETS,
+       H_REJECTED_PACKETS };
+
+String
+FFTSync::read_handler(Element *e, void *thunk)
+{
+    FFTSync *fs = (FFTSync *) e;
+    switch ((intptr_t) thunk)
+    {
+        case H_PENDING:
+        {
+            fs->_lock.acquire();
+            int pending = fs->_pending.size() + fs->_ops.size();
+            fs->_lock.release();
+            return String(pending);
+        }
+        case H_SENT_RECORDS:
+            return String(fs->_sent_records);
+        case H_SENT_PACKETS:
+            return String(fs->_sent_packets);
+        case H_DROPPED:
+            return String(fs->_dropped);
+        case H_SEND_ERRORS:
+            return String(fs->_send_errors);
+        case H_RECEIVED_RECORDS:
+            return String(fs->_received_records);
+        case H_RECEIVED_PACKETS:
+            return String(fs->_received_packets);
+        case H_LOST_PACKETS:
+            return String(fs->_lost_packets);
+        case H_BAD_PACKETS:
+            return String(fs->_bad_packets);
+        case H_REJECTED_PACKETS:
+            return String(fs->_rejected_packets);
+        default:
+            return "<error>";
+    }
+}
+
+void
+FFTSync::add_handlers()
+{
+    add_read_handler("pending", read_handler, H_PENDING);
+    add_read_handler("sent_records", read_handler, H_SENT_RECORDS);
+    add_read_handler("sent_packets", read_handler, H_SENT_PACKETS);
+    add_read_handler("dropped", read_handler, H_DROPPED);
+    add_read_handler("send_errors", read_handler, H_SEND_ERRORS);
+    add_read_handler("received_records", read_handler, H_RECEIVED_RECORDS);
+    add_read_handler("received_packets", read_handler, H_RECEIVED_PACKETS);
+    add_read_handler("lost_packets", read_handler, H_LOST_PACKETS);
+    add_read_handler("bad_packets", read_handler, H_BAD_PACKETS);
+    add_read_handler("rejected_packets", read_handler, H_REJECTED_PACKETS);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel)
+EXPORT_ELEMENT(FFTSync)
@@ -0,0 +1,154 @@
+#ifndef FFTSYNC_HH
+#define FFTSYNC_HH
+#include <click/element.hh>
+#include <click/hashtable.hh>
+#include <click/sync.hh>
+#include <click/timer.hh>
+#include <click/tokenbucket.hh>
+#include "fft.hh"
+#include <sys/socket.h>
+CLICK_DECLS
+
+class FFTSync : public Element, public FFTListener
+{
+    public:
+
+        FFTSync();
+        ~FFTSync();
+
+        const char *class_name() const { return "FFTSync"; }
+        const char *port_count() const { return PORTS_0_0; }
+
+        int configure(Vector<String> &conf, ErrorHandler *);
+        int initialize(ErrorHandler *);
+        void cleanup(CleanupStage);
+        void add_handlers();
+
+        void run_timer(Timer *);
+        void selected(int fd, int mask);
+
+        void flow_added(IPAddress src_addr, IPAddress dst_addr, uint16_t src_port,
+                        uint16_t dst_port, uint8_t proto, IPAddress gateway, uint8_t port,
+                        uint8_t ttl);
+        void flow_removed(IPAddress src_addr, IPAddress dst_addr, uint16_t src_port,
+                          uint16_t dst_port, uint8_t proto);
+        void port_removed(uint8_t port);
+        void prefix_removed(IPAddress addr, IPAddress mask);
+        void gateway_removed(IPAddress gateway);
+        void gateway_rerouted(IPAddress gateway, IPAddress new_gateway, int port);
+        void cleared();
+
+    private:
+
+        enum { MAGIC = 0x46465453, VERSION = 1, MAX_DATAGRAM = 1472 };
+
+        enum RecordType
+        {
+            R_ADD = 1, R_REMOVE_PORT, R_REMOVE_PREFIX, R_REMOVE_GATEWAY, R_REROUTE, R_CLEAR,
+            R_REMOVE_FLOW
+        };
+
+        // Datagram header and records, all fields in network byte order
+        struct Header
+        {
+            uint32_t magic;
+            uint16_t version;
+            uint16_t count;
+            uint32_t seq;
+        };
+
+        // R_ADD: a, b, c, d, e are source and destination address and port
+        // and gateway, flags is protocol. R_REMOVE_FLOW: the same without
+        // gateway. R_REMOVE_PREFIX: a, b are address and mask.
+        // R_REMOVE_GATEWAY: a is gateway. R_REROUTE: a, b are old and new
+        // gateway, port is used if flags is 1.
+        struct Record
+        {
+            uint8_t type;
+            uint8_t port;
+            uint8_t ttl;
+            uint8_t flags;
+            uint32_t a;
+            uint32_t b;
+            uint16_t c;
+            uint16_t d;
+            uint32_t e;
+        };
+
+        enum { MAX_RECORDS = (MAX_DATAGRAM - sizeof(Header)) / sizeof(Record) };
+
+        struct SyncKey
+        {
+            uint32_t sa;
+            uint32_t da;
+            uint16_t sp;
+            uint16_t dp;
+            uint8_t proto;
+
+            inline hashcode_t hashcode() const
+            {
+                return sa ^ (da * 2654435761U) ^ (((uint32_t) sp << 16) | dp) ^ proto;
+            }
+
+            inline bool operator==(const SyncKey &b) const
+            {
+                return sa == b.sa && da == b.da && sp == b.sp && dp == b.dp && proto == b.proto;
+            }
+        };
+
+        FFT *_table;
+        String _peer_name;
+        String _listen_name;
+        IPAddress _allow;
+        uint32_t _interval;
+        uint32_t _rate;
+        uint32_t _refresh;
+        uint32_t _max_pending;
+        bool _verbose;
+
+        int _send_fd;
+        int _recv_fd;
+        int _recv_family;
+        struct sockaddr_storage _peer;
+        socklen_t _peer_len;
+        String _unlink_path;
+
+        // Additions are coalesced by flow, operations are sent in order
+        // before them. Records are queued by threads writing the FFT and
+        // taken by the timer, so they are protected by _lock together with
+        // the token bucket and the dropped counter.
+        HashTable<SyncKey, Record> _pending;
+        Vector<Record> _ops;
+        Vector<Record> _out;
+        TokenBucket _tb;
+        SimpleSpinlock _lock;
+        Timer _timer;
+        uint32_t _tx_seq;
+        uint32_t _rx_seq;
+
+        // Thread applying received records, whose changes are not sent back
+        volatile int _applying;
+
+        uint64_t _sent_records;
+        uint64_t _sent_packets;
+        uint64_t _dropped;
+        uint64_t _send_errors;
+        uint64_t _received_records;
+        uint64_t _received_packets;
+        uint64_t _lost_packets;
+        uint64_t _bad_packets;
+        uint64_t _rejected_packets;
+
+        static int parse_endpoint(const String &, struct sockaddr_storage &, socklen_t &,
+                                  String &path, ErrorHandler *);
+        inline bool applying() const { return _applying == click_current_cpu_id(); }
+        inline void push_op(const Record &);
+        void flush();
+        void receive(const unsigned char *data, int len);
+        void apply(const Record &);
+
+        static String read_handler(Element *, void *);
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,211 @@
+#include <click/config.h>
+
+#include "flowarena.hh"
+#include <click/error.hh>
+#include <click/straccum.hh>
+#if CLICK_USERLEVEL
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+CLICK_DECLS
+
+#if CLICK_LINUXMODULE
+uint32_t FlowArena::instances = 0;
+#endif
+
+FlowArena::FlowArena() :
+    _object_size(0), _hugepages(true), _numa_node(-1),
+    _free(NULL), _capacity(0), _used(0), _failed(0)
+#if CLICK_LINUXMODULE
+    , _cache(NULL), _pool(NULL), _reserve(0)
+#endif
+{
+}
+
+FlowArena::~FlowArena()
+{
+    cleanup();
+}
+
+int
+FlowArena::initialize(size_t object_size, size_t prealloc, size_t reserve,
+                      bool hugepages, int numa_node, ErrorHandler *errh)
+{
+#if CLICK_LINUXMODULE
+    unsigned long flags = SLAB_HWCACHE_ALIGN;
+# ifdef SLAB_NO_MERGE
+    // Keep the cache separate, so it is accounted under its own name
+    flags |= SLAB_NO_MERGE;
+# endif
+
+    _object_size = object_size;
+    _reserve = reserve ? reserve : 1;
+
+    snprintf(_cache_name, sizeof(_cache_name), "famtar_fft_%u",
+             __sync_fetch_and_add(&instances, 1));
+    _cache = kmem_cache_create(_cache_name, object_size, 0, flags, NULL);
+    if (!_cache)
+        return errh->error("cannot create %s slab cache", _cache_name);
+
+    _pool = mempool_create_slab_pool(_reserve, _cache);
+    if (!_pool)
+        return errh->error("cannot preallocate %u entries reserve", (unsigned) _reserve);
+
+    (void) prealloc;
+    (void) hugepages;
+    (void) numa_node;
+    return 0;
+#else
+    (void) reserve;
+    _object_size = (object_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    _hugepages = hugepages;
+    _numa_node = numa_node;
+
+    do
+        if (!grow())
+            return errh->error("cannot allocate flow arena chunk");
+    while (_capacity < prealloc);
+
+    return 0;
+#endif
+}
+
+void
+FlowArena::cleanup()
+{
+#if CLICK_LINUXMODULE
+    // All objects must be already freed
+    if (_pool)
+        mempool_destroy(_pool);
+    if (_cache)
+        kmem_cache_destroy(_cache);
+
+    _pool = NULL;
+    _cache = NULL;
+    _used = 0;
+#endif
+
+    for (int i = 0; i < _chunks.size(); i++)
+        free_chunk(_chunks[i]);
+
+    _chunks.clear();
+    _free = NULL;
+    _capacity = 0;
+    _used = 0;
+}
+
+void *
+FlowArena::alloc_chunk(bool &huge)
+{
+#if CLICK_USERLEVEL
+    void *base = MAP_FAILED;
+    huge = false;
+
+# ifdef MAP_HUGETLB
+    if (_hugepages)
+    {
+        base = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        huge = (base != MAP_FAILED);
+    }
+# endif
+
+    if (base == MAP_FAILED)
+    {
+        base = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+            return NULL;
+# ifdef MADV_HUGEPAGE
+        // No reserved hugepages, ask for transparent ones instead
+        if (_hugepages)
+            madvise(base, CHUNK_SIZE, MADV_HUGEPAGE);
+# endif
+    }
+
+# ifdef SYS_mbind
+    // Pages are not touched yet, so they will be faulted in on the
+    // preferred node when the free list is built
+    if (_numa_node >= 0 && _numa_node < (int) (sizeof(unsigned long) * 8))
+    {
+        unsigned long nodemask = 1UL << _numa_node;
+        syscall(SYS_mbind, base, CHUNK_SIZE, 1 /* MPOL_PREFERRED */,
+                &nodemask, sizeof(nodemask) * 8, 0);
+    }
+# endif
+
+    return base;
+#else
+    huge = false;
+    return CLICK_LALLOC(CHUNK_SIZE);
+#endif
+}
+
+void
+FlowArena::free_chunk(const Chunk &chunk)
+{
+#if CLICK_USERLEVEL
+    munmap(chunk.base, CHUNK_SIZE);
+#else
+    CLICK_LFREE(chunk.base, CHUNK_SIZE);
+#endif
+}
+
+bool
+FlowArena::grow()
+{
+    Chunk chunk;
+    chunk.base = alloc_chunk(chunk.huge);
+
+    if (!chunk.base)
+        return false;
+
+    _chunks.push_back(chunk);
+
+    size_t n = CHUNK_SIZE / _object_size;
+    char *o = (char *) chunk.base + (n - 1) * _object_size;
+
+    // Build free list so objects are handed out in address order
+    for (size_t i = 0; i < n; i++, o -= _object_size)
+    {
+        ((FreeObject *) o)->next = _free;
+        _free = (FreeObject *) o;
+    }
+
+    _capacity += n;
+    return true;
+}
+
+String
+FlowArena::stats() const
+{
+#if CLICK_LINUXMODULE
+    StringAccum sa;
+    sa << "object_size " << _object_size << '\n'
+       << "used " << _used << '\n'
+       << "reserve " << _reserve << '\n'
+       << "reserve_free " << (_pool ? _pool->curr_nr : 0) << '\n'
+       << "failed " << _failed << '\n';
+    return sa.take_string();
+#else
+    int huge = 0;
+    for (int i = 0; i < _chunks.size(); i++)
+        if (_chunks[i].huge)
+            huge++;
+
+    StringAccum sa;
+    sa << "object_size " << _object_size << '\n'
+       << "chunks " << _chunks.size() << '\n'
+       << "hugepage_chunks " << huge << '\n'
+       << "capacity " << _capacity << '\n'
+       << "used " << _used << '\n'
+       << "free " << (_capacity - _used) << '\n'
+       << "bytes " << ((size_t) _chunks.size() * CHUNK_SIZE) << '\n'
+       << "failed " << _failed << '\n';
+    return sa.take_string();
+#endif
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(FlowArena)
@@ -0,0 +1,120 @@
+#ifndef FLOWARENA_HH
+#define FLOWARENA_HH
+#include <click/glue.hh>
+#include <click/vector.hh>
+#include <click/string.hh>
+#if CLICK_LINUXMODULE
+# include <click/cxxprotect.h>
+CLICK_CXX_PROTECT
+# include <linux/slab.h>
+# include <linux/mempool.h>
+CLICK_CXX_UNPROTECT
+# include <click/cxxunprotect.h>
+#endif
+CLICK_DECLS
+class ErrorHandler;
+
+class FlowArena
+{
+    public:
+
+        enum { CHUNK_SIZE = 2 * 1024 * 1024 };
+
+        FlowArena();
+        ~FlowArena();
+
+        int initialize(size_t object_size, size_t prealloc, size_t reserve,
+                       bool hugepages, int numa_node, ErrorHandler *);
+        void cleanup();
+
+        inline void *alloc();
+        inline void free(void *);
+
+        size_t capacity() const { return _capacity; }
+        size_t used() const { return _used; }
+        String stats() const;
+
+    private:
+
+        struct FreeObject
+        {
+            FreeObject *next;
+        };
+
+        struct Chunk
+        {
+            void *base;
+            bool huge;
+        };
+
+        size_t _object_size;
+        bool _hugepages;
+        int _numa_node;
+
+        Vector<Chunk> _chunks;
+        FreeObject *_free;
+        size_t _capacity;
+        size_t _used;
+        size_t _failed;
+
+#if CLICK_LINUXMODULE
+        // Objects are allocated from a dedicated slab cache, visible in
+        // /proc/slabinfo, with a mempool reserve for atomic context
+        struct kmem_cache *_cache;
+        mempool_t *_pool;
+        size_t _reserve;
+        // Each instance has its own cache name, so the caches of an old and
+        // a new router do not collide during a hot-swap. Older kernels keep
+        // the pointer, so the name lives as long as the cache.
+        char _cache_name[32];
+        static uint32_t instances;
+#endif
+
+        bool grow();
+        void *alloc_chunk(bool &huge);
+        void free_chunk(const Chunk &);
+};
+
+inline void *
+FlowArena::alloc()
+{
+#if CLICK_LINUXMODULE
+    // GFP_ATOMIC never sleeps, when both the slab and the reserve are
+    // exhausted allocation fails immediately
+    void *p = mempool_alloc(_pool, GFP_ATOMIC | __GFP_NOWARN);
+    if (unlikely(!p))
+    {
+        _failed++;
+        return NULL;
+    }
+    _used++;
+    return p;
+#else
+    if (unlikely(!_free) && !grow())
+    {
+        _failed++;
+        return NULL;
+    }
+
+    FreeObject *o = _free;
+    _free = o->next;
+    _used++;
+    return o;
+#endif
+}
+
+inline void
+FlowArena::free(void *p)
+{
+#if CLICK_LINUXMODULE
+    mempool_free(p, _pool);
+#else
+    FreeObject *o = (FreeObject *) p;
+    o->next = _free;
+    _free = o;
+#endif
+    _used--;
+}
+
+CLICK_ENDDECLS
+#endif
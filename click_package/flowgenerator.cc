@@ -0,0 +1,412 @@
+#include <click/config.h>
+
+#include "flowgenerator.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+#include <click/router.hh>
+#include <click/standard/scheduleinfo.hh>
+#include <clicknet/ether.h>
+#include <clicknet/ip.h>
+#include <clicknet/tcp.h>
+#include <clicknet/udp.h>
+#if HAVE_BATCH
+# include <click/packetbatch.hh>
+#endif
+#include <math.h>
+CLICK_DECLS
+
+FlowGenerator::FlowGenerator() :
+    _nflows(1000), _zipf(0), _churn(0), _length(64), _length_max(0), _tcp(1),
+    _ttl(64), _ttl_variation(0), _burst(32), _rate(0), _limit(-1), _stop(false),
+    _active(true), _seed(0), _churn_credit(0), _task(this), _timer(&_task), _count(0), _churned(0)
+{
+}
+
+FlowGenerator::~FlowGenerator()
+{
+}
+
+int
+FlowGenerator::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    _eth_src = EtherAddress();
+    _eth_dst = EtherAddress();
+
+    if (Args(conf, this, errh)
+        .read_mp("SRC", IPPrefixArg(true), _src, _src_mask)
+        .read_mp("DST", IPPrefixArg(true), _dst, _dst_mask)
+        .read("FLOWS", _nflows)
+        .read("ZIPF", _zipf)
+        .read("CHURN", _churn)
+        .read("LENGTH", _length)
+        .read("LENGTH_MAX", _length_max)
+        .read("TCP", _tcp)
+        .read("TTL", _ttl)
+        .read("TTL_VARIATION", _ttl_variation)
+        .read("ETH_SRC", _eth_src)
+        .read("ETH_DST", _eth_dst)
+        .read("BURST", _burst)
+        .read("RATE", _rate)
+        .read("LIMIT", _limit)
+        .read("STOP", _stop)
+        .read("ACTIVE", _active)
+        .read("SEED", _seed)
+        .complete() < 0)
+        return -1;
+
+    if (!_nflows)
+        return errh->error("FLOWS must be positive");
+    if (_zipf < 0)
+        return errh->error("ZIPF must not be negative");
+    if (_tcp < 0 || _tcp > 1 || _ttl_variation < 0 || _ttl_variation > 1)
+        return errh->error("TCP and TTL_VARIATION must be between 0 and 1");
+    if (_length < HEADER_LEN)
+        return errh->error("LENGTH must be at least %d", HEADER_LEN);
+    if (_length_max && _length_max < _length)
+        return errh->error("LENGTH_MAX must not be less than LENGTH");
+    if (_ttl < 4)
+        return errh->error("TTL must be at least 4");
+    if (!_burst)
+        return errh->error("BURST must be positive");
+
+    if (_rate)
+    {
+        _tb.assign(_rate, _rate / 100 > _burst ? _rate / 100 : _burst);
+        _tb.set_full();
+    }
+
+    return 0;
+}
+
+int
+FlowGenerator::initialize(ErrorHandler *errh)
+{
+    _rng = _seed ? _seed : (uint64_t) Timestamp::now().nsecval() | 1;
+    _ttl_threshold = (uint32_t) (_ttl_variation * 4294967295.0);
+
+    _flows.resize(_nflows);
+    for (uint32_t i = 0; i < _nflows; i++)
+        make_flow(_flows[i]);
+
+    build_alias_table();
+
+    _churn_last = Timestamp::now();
+    _timer.initialize(this);
+    ScheduleInfo::initialize_task(this, &_task, _active, errh);
+    return 0;
+}
+
+// xorshift64*
+inline uint64_t
+FlowGenerator::random()
+{
+    _rng ^= _rng >> 12;
+    _rng ^= _rng << 25;
+    _rng ^= _rng >> 27;
+    return _rng * 0x2545F4914F6CDD1DULL;
+}
+
+void
+FlowGenerator::make_flow(Flow &f)
+{
+    uint64_t r = random();
+    bool tcp = (r >> 11) * (1.0 / 9007199254740992.0) < _tcp;
+
+    memset(f.header, 0, sizeof(f.header));
+    f.ttl = _ttl;
+
+    click_ether *eth = (click_ether *) f.header;
+    memcpy(eth->ether_dhost, _eth_dst.data(), 6);
+    memcpy(eth->ether_shost, _eth_src.data(), 6);
+    eth->ether_type = htons(ETHERTYPE_IP);
+
+    click_ip *ip = (click_ip *) (eth + 1);
+    ip->ip_v = 4;
+    ip->ip_hl = sizeof(click_ip) >> 2;
+    ip->ip_ttl = f.ttl;
+    ip->ip_p = tcp ? IP_PROTO_TCP : IP_PROTO_UDP;
+    r = random();
+    ip->ip_src.s_addr = _src.addr() | ((uint32_t) r & ~_src_mask.addr());
+    ip->ip_dst.s_addr = _dst.addr() | ((uint32_t) (r >> 32) & ~_dst_mask.addr());
+
+    r = random();
+    uint16_t sport = htons(1024 + r % (65536 - 1024));
+    uint16_t dport = htons(1 + (r >> 16) % 65535);
+
+    if (tcp)
+    {
+        click_tcp *th = (click_tcp *) (ip + 1);
+        th->th_sport = sport;
+        th->th_dport = dport;
+        th->th_seq = htonl((uint32_t) (r >> 32));
+        th->th_off = sizeof(click_tcp) >> 2;
+        th->th_flags = TH_ACK;
+        th->th_win = htons(65535);
+        f.tcp_sum = click_in_cksum((const unsigned char *) th, sizeof(click_tcp));
+        f.header_len = sizeof(click_ether) + sizeof(click_ip) + sizeof(click_tcp);
+    }
+    else
+    {
+        click_udp *uh = (click_udp *) (ip + 1);
+        uh->uh_sport = sport;
+        uh->uh_dport = dport;
+        f.header_len = sizeof(click_ether) + sizeof(click_ip) + sizeof(click_udp);
+    }
+}
+
+// Vose's alias method, so that a flow is picked in constant time
+void
+FlowGenerator::build_alias_table()
+{
+    uint32_t n = _nflows;
+    Vector<double> p(n, 0);
+    Vector<uint32_t> small, large;
+    double sum = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+        sum += p[i] = pow(i + 1, -_zipf);
+
+    _prob.resize(n);
+    _alias.resize(n);
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        p[i] = p[i] * n / sum;
+        if (p[i] < 1)
+            small.push_back(i);
+        else
+            large.push_back(i);
+    }
+
+    while (small.size() && large.size())
+    {
+        uint32_t s = small.back(), l = large.back();
+        small.pop_back();
+        _prob[s] = (uint32_t) (p[s] * 4294967295.0);
+        _alias[s] = l;
+        p[l] -= 1 - p[s];
+        if (p[l] < 1)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    while (large.size())
+    {
+        _prob[large.back()] = 0xFFFFFFFF;
+        _alias[large.back()] = large.back();
+        large.pop_back();
+    }
+
+    // Leftovers caused by rounding errors
+    while (small.size())
+    {
+        _prob[small.back()] = 0xFFFFFFFF;
+        _alias[small.back()] = small.back();
+        small.pop_back();
+    }
+}
+
+inline uint32_t
+FlowGenerator::pick_flow()
+{
+    uint64_t r = random();
+    uint32_t i = ((r >> 32) * _nflows) >> 32;
+    return (uint32_t) r < _prob[i] ? i : _alias[i];
+}
+
+// Replaces randomly chosen flows with new ones, which keep popularity of
+// the replaced flows
+void
+FlowGenerator::churn(const Timestamp &now)
+{
+    _churn_credit += (now - _churn_last).doubleval() * _churn;
+    _churn_last = now;
+
+    while (_churn_credit >= 1)
+    {
+        make_flow(_flows[(random() >> 32) * _nflows >> 32]);
+        _churn_credit -= 1;
+        _churned++;
+    }
+}
+
+inline WritablePacket *
+FlowGenerator::make_packet(const Timestamp &now)
+{
+    const Flow &f = _flows[pick_flow()];
+    uint32_t len = _length;
+
+    if (_length_max > _length)
+        len += random() % (_length_max - _length + 1);
+
+    WritablePacket *q = Packet::make(Packet::default_headroom, NULL, len, 0);
+    if (!q)
+        return NULL;
+
+    memcpy(q->data(), f.header, f.header_len);
+    memset(q->data() + f.header_len, 0, len - f.header_len);
+
+    click_ip *ip = (click_ip *) (q->data() + sizeof(click_ether));
+    ip->ip_len = htons(len - sizeof(click_ether));
+
+    if (_ttl_threshold && (uint32_t) random() < _ttl_threshold)
+        ip->ip_ttl = f.ttl - 1 - random() % 3;
+
+    ip->ip_sum = click_in_cksum((const unsigned char *) ip, sizeof(click_ip));
+
+    // UDP checksum is left zero, i.e. not computed
+    if (ip->ip_p == IP_PROTO_UDP)
+        ((click_udp *) (ip + 1))->uh_ulen = htons(len - sizeof(click_ether) - sizeof(click_ip));
+    else
+        ((click_tcp *) (ip + 1))->th_sum = click_in_cksum_pseudohdr(
+            f.tcp_sum, ip, len - sizeof(click_ether) - sizeof(click_ip));
+
+    q->set_mac_header(q->data(), sizeof(click_ether));
+    q->set_timestamp_anno(now);
+    return q;
+}
+
+bool
+FlowGenerator::run_task(Task *)
+{
+    if (!_active)
+        return false;
+
+    uint32_t n = _burst;
+
+    if (_limit >= 0 && (uint64_t) _limit - _count < n)
+        n = _limit - _count;
+
+    // Without tokens, the task sleeps until the next one, as in RatedSource
+    if (_rate && n)
+    {
+        _tb.fill();
+        if (!_tb.contains(1))
+        {
+            _timer.schedule_after(Timestamp::make_jiffies(_tb.time_until_contains(1)));
+            return false;
+        }
+        if (_tb.size() < n)
+            n = _tb.size();
+        _tb.remove(n);
+    }
+
+    Timestamp now = Timestamp::now();
+
+    if (_churn)
+        churn(now);
+
+#if HAVE_BATCH
+    PacketBatch *head = NULL;
+    Packet *last = NULL;
+    uint32_t made = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        WritablePacket *q = make_packet(now);
+        if (!q)
+            break;
+        if (head)
+            last->set_next(q);
+        else
+            head = PacketBatch::start_head(q);
+        last = q;
+        made++;
+    }
+
+    if (head)
+    {
+        head->make_tail(last, made);
+        output_push_batch(0, head);
+    }
+#else
+    uint32_t made = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        WritablePacket *q = make_packet(now);
+        if (!q)
+            break;
+        output(0).push(q);
+        made++;
+    }
+#endif
+
+    _count += made;
+
+    if (_limit >= 0 && _count >= (uint64_t) _limit)
+    {
+        if (_stop)
+            router()->please_stop_driver();
+        return made > 0;
+    }
+
+    _task.fast_reschedule();
+    return made > 0;
+}
+
+enum { H_COUNT, H_CHURNED, H_RESET, H_ACTIVE };
+
+String
+FlowGenerator::read_handler(Element *e, void *thunk)
+{
+    FlowGenerator *fg = (FlowGenerator *) e;
+    switch ((intptr_t) thunk)
+    {
+        case H_COUNT:
+            return String(fg->_count);
+        case H_CHURNED:
+            return String(fg->_churned);
+        case H_ACTIVE:
+            return fg->_active ? "true" : "false";
+        default:
+            return "<error>";
+    }
+}
+
+int
+FlowGenerator::write_handler(const String &data, Element *e, void *thunk, ErrorHandler *errh)
+{
+    FlowGenerator *fg = (FlowGenerator *) e;
+    switch ((intptr_t) thunk)
+    {
+        case H_RESET:
+        {
+            fg->_count = 0;
+            fg->_churned = 0;
+            if (fg->_active)
+                fg->_task.reschedule();
+            return 0;
+        }
+        case H_ACTIVE:
+        {
+            if (!BoolArg().parse(data, fg->_active))
+                return errh->error("expected boolean");
+            if (fg->_active)
+            {
+                fg->_churn_last = Timestamp::now();
+                fg->_task.reschedule();
+            }
+            return 0;
+        }
+        default:
+            return -1;
+    }
+}
+
+void
+FlowGenerator::add_handlers()
+{
+    add_read_handler("count", read_handler, H_COUNT);
+    add_read_handler("churned", read_handler, H_CHURNED);
+    add_read_handler("active", read_handler, H_ACTIVE);
+    add_write_handler("active", write_handler, H_ACTIVE, Handler::CHECKBOX);
+    add_write_handler("reset", write_handler, H_RESET, Handler::BUTTON);
+    add_task_handlers(&_task);
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel)
+EXPORT_ELEMENT(FlowGenerator)
@@ -0,0 +1,90 @@
+#ifndef FLOWGENERATOR_HH
+#define FLOWGENERATOR_HH
+#include <click/batchelement.hh>
+#include <click/etheraddress.hh>
+#include <click/task.hh>
+#include <click/timer.hh>
+#include <click/tokenbucket.hh>
+CLICK_DECLS
+
+class FlowGenerator : public BatchElement
+{
+    public:
+
+        FlowGenerator();
+        ~FlowGenerator();
+
+        const char *class_name() const { return "FlowGenerator"; }
+        const char *port_count() const { return PORTS_0_1; }
+        const char *processing() const { return PUSH; }
+
+        int configure(Vector<String> &conf, ErrorHandler *);
+        int initialize(ErrorHandler *);
+        void add_handlers();
+
+        bool run_task(Task *);
+
+    private:
+
+        enum { HEADER_LEN = 14 + 20 + 20 };
+
+        // Frame headers of a flow are prepared once and copied to packets.
+        // Payload is zero, so the checksum of the TCP header is also the
+        // checksum of the segment without the pseudo header.
+        struct Flow
+        {
+            unsigned char header[HEADER_LEN];
+            uint8_t header_len;
+            uint8_t ttl;
+            uint16_t tcp_sum;
+        };
+
+        IPAddress _src;
+        IPAddress _src_mask;
+        IPAddress _dst;
+        IPAddress _dst_mask;
+        EtherAddress _eth_src;
+        EtherAddress _eth_dst;
+        uint32_t _nflows;
+        double _zipf;
+        double _churn;
+        uint32_t _length;
+        uint32_t _length_max;
+        double _tcp;
+        uint8_t _ttl;
+        double _ttl_variation;
+        uint32_t _burst;
+        uint32_t _rate;
+        int64_t _limit;
+        bool _stop;
+        bool _active;
+        uint64_t _seed;
+
+        Vector<Flow> _flows;
+        // Alias table for sampling flows by Zipf popularity
+        Vector<uint32_t> _prob;
+        Vector<uint32_t> _alias;
+
+        uint64_t _rng;
+        uint32_t _ttl_threshold;
+        double _churn_credit;
+        Timestamp _churn_last;
+        TokenBucket _tb;
+        Task _task;
+        Timer _timer;
+        uint64_t _count;
+        uint64_t _churned;
+
+        inline uint64_t random();
+        void make_flow(Flow &);
+        void build_alias_table();
+        inline uint32_t pick_flow();
+        void churn(const Timestamp &now);
+        inline WritablePacket *make_packet(const Timestamp &now);
+
+        static String read_handler(Element *, void *);
+        static int write_handler(const String &, Element *, void *, ErrorHandler *);
+};
+
+CLICK_ENDDECLS
+#endif
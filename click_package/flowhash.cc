@@ -0,0 +1,157 @@
+#include <click/config.h>
+
+#include "flowhash.hh"
+#include <click/error.hh>
+CLICK_DECLS
+
+// Default RSS key used by many NIC drivers
+static const uint8_t default_rss_key[FlowHash::RSS_KEY_SIZE] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
+uint32_t FlowHash::_crc32c_table[256];
+
+FlowHash::FlowHash() :
+    _type(JENKINS), _crc32c_insn(false)
+{
+}
+
+int
+FlowHash::configure(const String &type, const String &rss_key, ErrorHandler *errh)
+{
+    String t = type.lower();
+
+    if (t == "jenkins")
+        _type = JENKINS;
+    else if (t == "crc32c")
+        _type = CRC32C;
+    else if (t == "toeplitz")
+        _type = TOEPLITZ;
+    else if (t == "rss")
+        _type = RSS;
+    else
+        return errh->error("HASH must be one of jenkins, crc32c, toeplitz, rss");
+
+    if (_type == CRC32C)
+    {
+        init_crc32c_table();
+#if FLOWHASH_HAVE_CRC32C_INSN
+        _crc32c_insn = __builtin_cpu_supports("sse4.2");
+#endif
+    }
+
+    if (_type == TOEPLITZ || _type == RSS)
+    {
+        uint8_t key[RSS_KEY_SIZE];
+
+        if (!rss_key)
+            memcpy(key, default_rss_key, RSS_KEY_SIZE);
+        else
+        {
+            // Hexadecimal string, optionally with ':' separators
+            int n = 0;
+            for (const char *s = rss_key.begin(); s != rss_key.end(); s++)
+            {
+                int v;
+                if (*s >= '0' && *s <= '9')
+                    v = *s - '0';
+                else if (*s >= 'a' && *s <= 'f')
+                    v = *s - 'a' + 10;
+                else if (*s >= 'A' && *s <= 'F')
+                    v = *s - 'A' + 10;
+                else if (*s == ':')
+                    continue;
+                else
+                    return errh->error("RSS_KEY must be a hexadecimal string");
+
+                if (n >= 2 * RSS_KEY_SIZE)
+                    return errh->error("RSS_KEY too long");
+                if (n % 2 == 0)
+                    key[n / 2] = v << 4;
+                else
+                    key[n / 2] |= v;
+                n++;
+            }
+            // Only first 16 bytes are used for IPv4 4-tuple, rest is zeroed
+            if (n % 2 || n < 32)
+                return errh->error("RSS_KEY must have at least 16 bytes");
+            memset(key + n / 2, 0, RSS_KEY_SIZE - n / 2);
+        }
+
+        init_toeplitz(key);
+    }
+
+    return 0;
+}
+
+const char *
+FlowHash::type_name() const
+{
+    switch (_type)
+    {
+        case CRC32C:
+            return "crc32c";
+        case TOEPLITZ:
+            return "toeplitz";
+        case RSS:
+            return "rss";
+        default:
+            return "jenkins";
+    }
+}
+
+void
+FlowHash::init_crc32c_table()
+{
+    // Castagnoli polynomial, reflected
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int j = 0; j < 8; j++)
+            c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : (c >> 1);
+        _crc32c_table[i] = c;
+    }
+}
+
+#if FLOWHASH_HAVE_CRC32C_INSN
+uint32_t
+FlowHash::crc32c_hw(uint32_t sa, uint32_t da, uint16_t sp, uint16_t dp)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    crc = _mm_crc32_u32(crc, sa);
+    crc = _mm_crc32_u32(crc, da);
+    crc = _mm_crc32_u32(crc, sp | ((uint32_t) dp << 16));
+    return crc;
+}
+#endif
+
+// For every input byte position and value, precompute XOR of 32-bit key
+// windows selected by bits of that byte, as defined by RSS specification
+void
+FlowHash::init_toeplitz(const uint8_t *key)
+{
+    for (int pos = 0; pos < 12; pos++)
+        for (int v = 0; v < 256; v++)
+        {
+            uint32_t h = 0;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                if (!(v & (0x80 >> bit)))
+                    continue;
+
+                int k = pos * 8 + bit;
+                uint64_t w = ((uint64_t) key[k / 8] << 32) | ((uint64_t) key[k / 8 + 1] << 24)
+                           | ((uint64_t) key[k / 8 + 2] << 16) | ((uint64_t) key[k / 8 + 3] << 8)
+                           | key[k / 8 + 4];
+                h ^= (uint32_t) (w >> (8 - k % 8));
+            }
+            _toeplitz[pos][v] = h;
+        }
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(FlowHash)
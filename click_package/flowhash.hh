@@ -0,0 +1,111 @@
+#ifndef FLOWHASH_HH
+#define FLOWHASH_HH
+#include <click/glue.hh>
+#include <click/string.hh>
+#if CLICK_USERLEVEL && (defined(__x86_64__) || defined(__i386__))
+# include <nmmintrin.h>
+# define FLOWHASH_HAVE_CRC32C_INSN 1
+#endif
+CLICK_DECLS
+class ErrorHandler;
+
+class FlowHash
+{
+    public:
+
+        enum Type
+        {
+            JENKINS, CRC32C, TOEPLITZ, RSS
+        };
+
+        enum { RSS_KEY_SIZE = 40 };
+
+        FlowHash();
+
+        int configure(const String &type, const String &rss_key, ErrorHandler *);
+
+        Type type() const { return _type; }
+        const char *type_name() const;
+
+        // Addresses and ports in network byte order
+        inline uint32_t hash(uint32_t sa, uint32_t da, uint16_t sp, uint16_t dp) const;
+
+    private:
+
+        Type _type;
+        bool _crc32c_insn;
+        uint32_t _toeplitz[12][256];
+
+        static uint32_t _crc32c_table[256];
+
+        inline uint32_t jenkins(uint32_t sa, uint32_t da, uint16_t sp, uint16_t dp) const;
+        inline uint32_t crc32c_sw(uint32_t crc, uint32_t v) const;
+#if FLOWHASH_HAVE_CRC32C_INSN
+        static uint32_t crc32c_hw(uint32_t sa, uint32_t da, uint16_t sp, uint16_t dp)
+            __attribute__((target("sse4.2")));
+#endif
+        inline uint32_t toeplitz(uint32_t sa, uint32_t da, uint16_t sp, uint16_t dp) const;
+
+        static void init_crc32c_table();
+        void init_toeplitz(const uint8_t *key);
+};
+
+inline uint32_t
+FlowHash::jenkins(uint32_t sa, uint32_t da, uint16_t sp, uint16_t dp) const
+{
+    uint32_t a = (sa * 59) ^ da;
+    a = a ^ sp ^ ((uint32_t) dp << 16);
+    // Bob Jenkins http://burtleburtle.net/bob/hash/integer.html
+    a = (a + 0x7ed55d16) + (a << 12);
+    a = (a ^ 0xc761c23c) ^ (a >> 19);
+    a = (a + 0x165667b1) + (a << 5);
+    a = (a + 0xd3a2646c) ^ (a << 9);
+    a = (a + 0xfd7046c5) + (a << 3);
+    a = (a ^ 0xb55a4f09) ^ (a >> 16);
+    return a;
+}
+
+inline uint32_t
+FlowHash::crc32c_sw(uint32_t crc, uint32_t v) const
+{
+    for (int i = 0; i < 4; i++, v >>= 8)
+        crc = _crc32c_table[(crc ^ v) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+inline uint32_t
+FlowHash::toeplitz(uint32_t sa, uint32_t da, uint16_t sp, uint16_t dp) const
+{
+    const uint8_t *s = (const uint8_t *) &sa;
+    const uint8_t *d = (const uint8_t *) &da;
+    const uint8_t *ps = (const uint8_t *) &sp;
+    const uint8_t *pd = (const uint8_t *) &dp;
+
+    return _toeplitz[0][s[0]] ^ _toeplitz[1][s[1]] ^ _toeplitz[2][s[2]] ^ _toeplitz[3][s[3]]
+         ^ _toeplitz[4][d[0]] ^ _toeplitz[5][d[1]] ^ _toeplitz[6][d[2]] ^ _toeplitz[7][d[3]]
+         ^ _toeplitz[8][ps[0]] ^ _toeplitz[9][ps[1]] ^ _toeplitz[10][pd[0]] ^ _toeplitz[11][pd[1]];
+}
+
+// Keys built from packets in RSS mode take the hash from the annotation,
+// other keys use Toeplitz hash with the same key as the NIC
+inline uint32_t
+FlowHash::hash(uint32_t sa, uint32_t da, uint16_t sp, uint16_t dp) const
+{
+    switch (_type)
+    {
+        case CRC32C:
+#if FLOWHASH_HAVE_CRC32C_INSN
+            if (_crc32c_insn)
+                return crc32c_hw(sa, da, sp, dp);
+#endif
+            return crc32c_sw(crc32c_sw(crc32c_sw(0xFFFFFFFF, sa), da), sp | ((uint32_t) dp << 16));
+        case TOEPLITZ:
+        case RSS:
+            return toeplitz(sa, da, sp, dp);
+        default:
+            return jenkins(sa, da, sp, dp);
+    }
+}
+
+CLICK_ENDDECLS
+#endif
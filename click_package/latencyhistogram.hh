@@ -0,0 +1,91 @@
+#ifndef LATENCYHISTOGRAM_HH
+#define LATENCYHISTOGRAM_HH
+#include <click/glue.hh>
+#include <click/string.hh>
+CLICK_DECLS
+
+// Log-scale histogram of cycle counts. Each power of two is split into 4
+// buckets, so reported percentiles are at most 25 % above the real value.
+class LatencyHistogram
+{
+    public:
+
+        enum { SUB_BITS = 2, SUB = 1 << SUB_BITS, NBUCKETS = (64 - SUB_BITS + 1) * SUB };
+
+        LatencyHistogram() { reset(); }
+
+        void reset()
+        {
+            memset(_buckets, 0, sizeof(_buckets));
+            _count = 0;
+            _max = 0;
+        }
+
+        inline void record(uint64_t v)
+        {
+            _buckets[bucket(v)]++;
+            _count++;
+            if (v > _max)
+                _max = v;
+        }
+
+        void merge(const LatencyHistogram &h)
+        {
+            for (int i = 0; i < NBUCKETS; i++)
+                _buckets[i] += h._buckets[i];
+            _count += h._count;
+            if (h._max > _max)
+                _max = h._max;
+        }
+
+        uint64_t count() const { return _count; }
+        uint64_t max() const { return _max; }
+
+        // Returns upper bound of the bucket containing the num/den quantile
+        uint64_t percentile(uint64_t num, uint64_t den) const
+        {
+            if (!_count)
+                return 0;
+
+            uint64_t rank = (_count * num + den - 1) / den;
+            uint64_t seen = 0;
+
+            for (int i = 0; i < NBUCKETS; i++)
+            {
+                seen += _buckets[i];
+                if (seen >= rank && _buckets[i])
+                {
+                    uint64_t upper = bucket_upper(i);
+                    return upper < _max ? upper : _max;
+                }
+            }
+
+            return _max;
+        }
+
+    private:
+
+        uint64_t _buckets[NBUCKETS];
+        uint64_t _count;
+        uint64_t _max;
+
+        static inline int bucket(uint64_t v)
+        {
+            if (v < SUB)
+                return v;
+            int msb = 63 - __builtin_clzll(v);
+            return (msb - SUB_BITS + 1) * SUB + ((v >> (msb - SUB_BITS)) & (SUB - 1));
+        }
+
+        static inline uint64_t bucket_upper(int i)
+        {
+            if (i < SUB)
+                return i;
+            int shift = i / SUB - 1;
+            uint64_t lower = (uint64_t) (SUB + i % SUB) << shift;
+            return lower + ((uint64_t) 1 << shift) - 1;
+        }
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,203 @@
+#include <click/config.h>
+
+#include "lookupaddfft.hh"
+#include <click/args.hh>
+#include <click/error.hh>
+
+#include "packet_info.hh"
+CLICK_DECLS
+
+LookupAddFFT::LookupAddFFT() :
+    _table(NULL), _routes(NULL), _local_port(-1), _verbose(false),
+    _no_route_printed(false), _down_timer(this), _new_flow_rate(0), _new_flow_burst(0),
+    _rejected(0), _deferred(0)
+{
+}
+
+LookupAddFFT::~LookupAddFFT()
+{
+}
+
+int
+LookupAddFFT::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    if (Args(conf, this, errh)
+        .read_mp("TABLE", ElementCastArg("FFT"), _table)
+        .read_mp("ROUTES", ElementCastArg("IPRouteTable"), _routes)
+        .read("LOCAL_PORT", _local_port)
+        .read("VERBOSE", _verbose)
+        .read("NEW_FLOW_RATE", _new_flow_rate)
+        .read("NEW_FLOW_BURST", _new_flow_burst)
+        .complete() < 0)
+        return -1;
+
+    if (_new_flow_rate)
+    {
+        _new_flow_bucket.assign(_new_flow_rate, _new_flow_burst ? _new_flow_burst : _new_flow_rate);
+        _new_flow_bucket.set_full();
+    }
+
+    _table->add_user(this);
+    return 0;
+}
+
+int
+LookupAddFFT::initialize(ErrorHandler *)
+{
+    _down_until.assign(noutputs(), Timestamp());
+    _down_timer.initialize(this);
+
+    return 0;
+}
+
+inline int
+LookupAddFFT::process(Packet *p)
+{
+    IPAddress gw;
+    int port = _routes->lookup_route(p->dst_ip_anno(), gw);
+
+    if (port < 0 || port >= noutputs())
+    {
+        if (_verbose || !_no_route_printed)
+        {
+            click_chatter("LookupAddFFT: no route for packet: %s", packet_info(p).c_str());
+            _no_route_printed = true;
+        }
+        return noutputs();
+    }
+
+    if (gw)
+        p->set_dst_ip_anno(gw);
+
+    // Flows are added inline, with the same admission as AddFFT without
+    // GROUP and QUEUE
+    if (port != _local_port && !_down_until[port])
+    {
+        int ret = _table->add_flow(p, port, _new_flow_rate ? &_new_flow_bucket : NULL);
+
+        if (ret == -2)
+            _rejected++;
+        else if (ret == -3)
+            _deferred++;
+
+        if (_verbose)
+            click_chatter("LookupAddFFT: %s port: %d%s", packet_info(p).c_str(), port,
+                          ret == -2 ? " rejected" : (ret == -3 ? " deferred" : ""));
+    }
+
+    return port;
+}
+
+void
+LookupAddFFT::push(int, Packet *p)
+{
+    checked_output_push(process(p), p);
+}
+
+#if HAVE_BATCH
+void
+LookupAddFFT::push_batch(int, PacketBatch *batch)
+{
+    CLASSIFY_EACH_PACKET(noutputs() + 1, process, batch, checked_output_push_batch);
+}
+#endif
+
+void
+LookupAddFFT::set_down(int port)
+{
+    if (port < 0 || port >= noutputs())
+        return;
+
+    if (_down_timer.initialized())
+    {
+        _down_until[port] = Timestamp::now() + Timestamp(5);
+        if (!_down_timer.scheduled())
+            _down_timer.schedule_at(_down_until[port]);
+    }
+
+    _table->remove_flows(port);
+}
+
+void
+LookupAddFFT::set_up(int port)
+{
+    if (port >= 0 && port < noutputs())
+        _down_until[port] = Timestamp();
+}
+
+void
+LookupAddFFT::run_timer(Timer *timer)
+{
+    assert(timer == &_down_timer);
+
+    Timestamp now = Timestamp::now();
+    Timestamp next;
+
+    for (int port = 0; port < _down_until.size(); port++)
+    {
+        if (!_down_until[port])
+            continue;
+        if (_down_until[port] <= now)
+            _down_until[port] = Timestamp();
+        else if (!next || _down_until[port] < next)
+            next = _down_until[port];
+    }
+
+    if (next)
+        _down_timer.schedule_at(next);
+}
+
+enum { H_DOWN, H_UP, H_REJECTED, H_DEFERRED };
+
+String
+LookupAddFFT::read_handler(Element *e, void *thunk)
+{
+    LookupAddFFT *lookupaddfft = (LookupAddFFT *) e;
+    switch ((intptr_t) thunk)
+    {
+        case H_REJECTED:
+            return String(lookupaddfft->_rejected);
+        case H_DEFERRED:
+            return String(lookupaddfft->_deferred);
+        default:
+            return "<error>";
+    }
+}
+
+int
+LookupAddFFT::write_handler(const String &data, Element *e, void *thunk, ErrorHandler *errh)
+{
+    LookupAddFFT *lookupaddfft = (LookupAddFFT *) e;
+    int port;
+
+    if (!IntArg().parse(data, port))
+        return errh->error("expected port number");
+
+    switch ((intptr_t) thunk)
+    {
+        case H_DOWN:
+        {
+            lookupaddfft->set_down(port);
+            return 0;
+        }
+        case H_UP:
+        {
+            lookupaddfft->set_up(port);
+            return 0;
+        }
+        default:
+            return -1;
+    }
+}
+
+void
+LookupAddFFT::add_handlers()
+{
+    add_write_handler("down", write_handler, H_DOWN);
+    add_write_handler("up", write_handler, H_UP);
+    add_read_handler("rejected", read_handler, H_REJECTED);
+    add_read_handler("deferred", read_handler, H_DEFERRED);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(LookupAddFFT)
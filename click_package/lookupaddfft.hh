@@ -0,0 +1,56 @@
+#ifndef LOOKUPADDFFT_HH
+#define LOOKUPADDFFT_HH
+#include <click/batchelement.hh>
+#include <click/timer.hh>
+#include "fft.hh"
+#include "iproutetable.hh"
+CLICK_DECLS
+
+class LookupAddFFT : public BatchElement
+{
+    public:
+
+        LookupAddFFT();
+        ~LookupAddFFT();
+
+        const char *class_name() const { return "LookupAddFFT"; }
+        const char *port_count() const { return "1/-"; }
+        const char *processing() const { return PUSH; }
+
+        int configure(Vector<String> &conf, ErrorHandler *);
+        int initialize(ErrorHandler *);
+        void add_handlers();
+
+        void push(int, Packet *);
+    #if HAVE_BATCH
+        void push_batch (int, PacketBatch *);
+    #endif
+
+        void run_timer(Timer *timer);
+
+        void set_down(int port);
+        void set_up(int port);
+
+    private:
+
+        FFT *_table;
+        IPRouteTable *_routes;
+        int _local_port;
+        bool _verbose;
+        bool _no_route_printed;
+        Timer _down_timer;
+        Vector<Timestamp> _down_until;
+        uint32_t _new_flow_rate;
+        uint32_t _new_flow_burst;
+        TokenBucket _new_flow_bucket;
+        uint64_t _rejected;
+        uint64_t _deferred;
+
+        inline int process(Packet *);
+
+        static String read_handler(Element *, void *);
+        static int write_handler(const String &, Element *, void *, ErrorHandler *);
+};
+
+CLICK_ENDDECLS
+#endif
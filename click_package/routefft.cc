@@ -8,7 +8,7 @@
 CLICK_DECLS
 
 RouteFFT::RouteFFT() :
-    _table(NULL), _verbose(false), _no_route_printed(false)
+    _table(NULL), _verbose(false), _no_route_printed(false), _group(true)
 {
 }
 
@@ -22,9 +22,11 @@ RouteFFT::configure(Vector<String> &conf, ErrorHandler *errh)
     if (Args(conf, this, errh)
         .read_mp("TABLE", ElementCastArg("FFT"), _table)
         .read("VERBOSE", _verbose)
+        .read("GROUP", _group)
         .complete() < 0)
         return -1;
 
+    _table->add_user(this);
     return 0;
 }
 
@@ -56,6 +58,28 @@ RouteFFT::process(Packet *p)
     }
 }
 
+inline int
+RouteFFT::process(const FFT::PacketRun &run)
+{
+    int port = _table->route_flow(run);
+
+    if (_verbose)
+        click_chatter("RouteFFT: %s packets: %u port: %d", packet_info(run.first).c_str(),
+                      run.count, port);
+
+    if (port >= 0)
+        return port;
+    else
+    {
+        if (_verbose || !_no_route_printed)
+        {
+            click_chatter("RouteFFT: no route for packet: %s", packet_info(run.first).c_str());
+            _no_route_printed = true;
+        }
+        return noutputs();
+    }
+}
+
 void
 RouteFFT::push(int, Packet *p)
 {
@@ -66,7 +90,12 @@ RouteFFT::push(int, Packet *p)
 void
 RouteFFT::push_batch(int, PacketBatch *batch)
 {
-    CLASSIFY_EACH_PACKET(noutputs() + 1, process, batch, checked_output_push_batch);
+    if (_group)
+        _table->classify_runs(batch, noutputs() + 1,
+                              [this](const FFT::PacketRun &run) { return process(run); },
+                              [this](int port, PacketBatch *b) { checked_output_push_batch(port, b); });
+    else
+        CLASSIFY_EACH_PACKET(noutputs() + 1, process, batch, checked_output_push_batch);
 }
 #endif
 
@@ -28,7 +28,9 @@ class RouteFFT : public BatchElement
         FFT *_table;
         bool _verbose;
         bool _no_route_printed;
+        bool _group;
         inline int process(Packet *);
+        inline int process(const FFT::PacketRun &);
 };
 
 CLICK_ENDDECLS
@@ -0,0 +1,344 @@
+#include <click/config.h>
+
+#include "shmflowtable.hh"
+#include <click/error.hh>
+#if CLICK_USERLEVEL
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <signal.h>
+# include <unistd.h>
+#endif
+CLICK_DECLS
+
+SharedFlowTable::SharedFlowTable() :
+    _pid(0), _base(NULL), _length(0), _header(NULL), _buckets(NULL)
+{
+}
+
+SharedFlowTable::~SharedFlowTable()
+{
+    close();
+}
+
+#if CLICK_USERLEVEL
+
+// An object left by a creator which died before initializing it is removed
+// and the table is created again
+int
+SharedFlowTable::open(const String &name, uint32_t size, uint32_t hash_type, ErrorHandler *errh)
+{
+    uint32_t nbuckets = 1;
+    while (nbuckets * WAYS < size)
+        nbuckets <<= 1;
+
+    _name = name[0] == '/' ? name : "/" + name;
+    _length = sizeof(Header) + (size_t) nbuckets * sizeof(Bucket);
+    _pid = getpid();
+
+    int r = attach(nbuckets, hash_type, errh);
+    if (r == -EAGAIN)
+        r = attach(nbuckets, hash_type, errh);
+    if (r == -EAGAIN)
+        return errh->error("%s: timeout waiting for table initialization", _name.c_str());
+
+    return r;
+}
+
+// Object is unlinked only if the name still refers to it, so a table
+// created meanwhile by another process is kept
+void
+SharedFlowTable::remove_stale(int fd)
+{
+    struct stat st, cur;
+    int fd2 = shm_open(_name.c_str(), O_RDWR, 0600);
+
+    if (fd2 < 0)
+        return;
+
+    if (fstat(fd, &st) == 0 && fstat(fd2, &cur) == 0 && st.st_ino == cur.st_ino)
+    {
+        click_chatter("%s: removing uninitialized table", _name.c_str());
+        shm_unlink(_name.c_str());
+    }
+
+    ::close(fd2);
+}
+
+// Returns -EAGAIN if a stale object was found and removed
+int
+SharedFlowTable::attach(uint32_t nbuckets, uint32_t hash_type, ErrorHandler *errh)
+{
+    bool creator = true;
+    int fd = shm_open(_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0 && errno == EEXIST)
+    {
+        creator = false;
+        fd = shm_open(_name.c_str(), O_RDWR, 0600);
+    }
+
+    if (fd < 0)
+        return errh->error("shm_open %s: %s", _name.c_str(), strerror(errno));
+
+    if (creator && ftruncate(fd, _length) < 0)
+    {
+        errh->error("ftruncate %s: %s", _name.c_str(), strerror(errno));
+        ::close(fd);
+        shm_unlink(_name.c_str());
+        return -1;
+    }
+
+    // Wait until the creator sets the size of the object
+    for (int i = 0; !creator; i++)
+    {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(Header))
+        {
+            if ((size_t) st.st_size != _length)
+            {
+                ::close(fd);
+                return errh->error("%s: existing table has different SHM_SIZE", _name.c_str());
+            }
+            break;
+        }
+        if (i == 1000)
+        {
+            remove_stale(fd);
+            ::close(fd);
+            return -EAGAIN;
+        }
+        usleep(1000);
+    }
+
+    _base = mmap(NULL, _length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (_base == MAP_FAILED)
+    {
+        _base = NULL;
+        ::close(fd);
+        return errh->error("mmap %s: %s", _name.c_str(), strerror(errno));
+    }
+
+    _header = (Header *) _base;
+    _buckets = (Bucket *) (_header + 1);
+
+    if (creator)
+    {
+        // New object is zero filled, so all entries are invalid and unlocked
+        _header->version = VERSION;
+        _header->nbuckets = nbuckets;
+        _header->hash_type = hash_type;
+        __sync_synchronize();
+        _header->magic = MAGIC;
+    }
+    else
+    {
+        for (int i = 0; ((volatile Header *) _header)->magic != MAGIC; i++)
+        {
+            if (i == 1000)
+            {
+                remove_stale(fd);
+                ::close(fd);
+                close();
+                return -EAGAIN;
+            }
+            usleep(1000);
+        }
+        __sync_synchronize();
+
+        if (_header->version != VERSION || _header->nbuckets != nbuckets)
+        {
+            ::close(fd);
+            return errh->error("%s: existing table has different version or size", _name.c_str());
+        }
+        if (_header->hash_type != hash_type)
+        {
+            ::close(fd);
+            return errh->error("%s: existing table uses different HASH or KEY", _name.c_str());
+        }
+    }
+
+    ::close(fd);
+    return 0;
+}
+
+// Only ESRCH means that the process does not exist, EPERM is returned for
+// live processes of other users. Processes sharing the table must be in the
+// same pid namespace.
+bool
+SharedFlowTable::owner_dead(uint32_t pid)
+{
+    return kill(pid, 0) < 0 && errno == ESRCH;
+}
+
+void
+SharedFlowTable::close()
+{
+    // The object is not unlinked, it is shared with other processes
+    if (_base)
+        munmap(_base, _length);
+
+    _base = NULL;
+    _header = NULL;
+    _buckets = NULL;
+}
+
+#else
+
+int
+SharedFlowTable::open(const String &, uint32_t, uint32_t, ErrorHandler *errh)
+{
+    return errh->error("shared memory table is supported only in userlevel");
+}
+
+bool
+SharedFlowTable::owner_dead(uint32_t)
+{
+    return false;
+}
+
+void
+SharedFlowTable::close()
+{
+}
+
+#endif
+
+// Owner may have died in the middle of an update, so all entries of the
+// bucket are invalidated, their flows are pinned again
+void
+SharedFlowTable::recover(Bucket *b, uint32_t owner)
+{
+    int removed = 0;
+
+    for (int i = 0; i < WAYS; i++)
+        if (b->e[i].valid)
+        {
+            b->e[i].valid = 0;
+            removed++;
+        }
+
+    __sync_fetch_and_sub(&_header->size, removed);
+    click_chatter("%s: recovered bucket %u locked by dead process %u", _name.c_str(),
+                  (unsigned) (b - _buckets), owner);
+}
+
+bool
+SharedFlowTable::contains(const Key &key)
+{
+    Bucket *b = bucket(key);
+    lock(b);
+    bool found = find(b, key) != NULL;
+    unlock(b);
+    return found;
+}
+
+bool
+SharedFlowTable::remove(const Key &key)
+{
+    Bucket *b = bucket(key);
+    lock(b);
+    Entry *e = find(b, key);
+    if (e)
+    {
+        e->valid = 0;
+        __sync_fetch_and_sub(&_header->size, 1);
+    }
+    unlock(b);
+    return e != NULL;
+}
+
+bool
+SharedFlowTable::get(const Key &key, uint8_t &port, uint32_t &gateway)
+{
+    Bucket *b = bucket(key);
+    lock(b);
+    Entry *e = find(b, key);
+    if (e)
+    {
+        port = e->port;
+        gateway = e->gateway;
+    }
+    unlock(b);
+    return e != NULL;
+}
+
+// Returns true and refreshes timestamp if the entry is active and its TTL
+// matches 'ttl' (ttl < 0 disables the comparison). Entry TTL 0 matches any
+// TTL, which is then stored.
+bool
+SharedFlowTable::check(const Key &key, uint32_t now, uint32_t timeout, int ttl,
+                       uint8_t &port, uint32_t &gateway)
+{
+    Bucket *b = bucket(key);
+    bool ret = false;
+
+    lock(b);
+    Entry *e = find(b, key);
+    if (e && !is_expired(now, e->ts, timeout) && (ttl < 0 || e->ttl == ttl || !e->ttl))
+    {
+        if (ttl >= 0)
+            e->ttl = ttl;
+        e->ts = now;
+        port = e->port;
+        gateway = e->gateway;
+        ret = true;
+    }
+    unlock(b);
+
+    return ret;
+}
+
+// When the bucket is full, the least recently used entry is replaced
+int
+SharedFlowTable::insert(const Key &key, uint32_t ts, uint32_t gateway, uint8_t port, uint8_t ttl,
+                        bool overwrite, uint32_t timeout, bool loop_avoidance)
+{
+    Bucket *b = bucket(key);
+
+    lock(b);
+
+    Entry *e = find(b, key);
+
+    if (e && !overwrite && !is_expired(ts, e->ts, timeout)
+        && (!loop_avoidance || e->ttl == ttl))
+    {
+        unlock(b);
+        return -1;
+    }
+
+    if (!e)
+    {
+        for (int i = 0; i < WAYS; i++)
+            if (!b->e[i].valid)
+            {
+                e = &b->e[i];
+                break;
+            }
+
+        if (e)
+            __sync_fetch_and_add(&_header->size, 1);
+        else
+        {
+            e = &b->e[0];
+            for (int i = 1; i < WAYS; i++)
+                if ((int32_t) (b->e[i].ts - e->ts) < 0)
+                    e = &b->e[i];
+        }
+
+        e->key = key;
+    }
+
+    e->ts = ts;
+    e->gateway = gateway;
+    e->port = port;
+    e->ttl = ttl;
+    e->valid = 1;
+
+    unlock(b);
+    return 0;
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(SharedFlowTable)
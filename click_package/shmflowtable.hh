@@ -0,0 +1,189 @@
+#ifndef SHMFLOWTABLE_HH
+#define SHMFLOWTABLE_HH
+#include <click/glue.hh>
+#include <click/string.hh>
+CLICK_DECLS
+class ErrorHandler;
+
+// Flow table stored in a named POSIX shared memory object, which can be
+// mapped by several Click processes at once. The table is a fixed array of
+// set-associative buckets, each protected by its own spinlock living in the
+// shared memory, so no pointers are stored in the region. The lock word holds
+// the pid of its owner, so a bucket locked by a process which died is
+// recovered by the others.
+class SharedFlowTable
+{
+    public:
+
+        enum { WAYS = 4 };
+
+        struct Key
+        {
+            uint32_t sa;
+            uint32_t da;
+            uint16_t sp;
+            uint16_t dp;
+            uint32_t hash;
+        };
+
+        struct Entry
+        {
+            Key key;
+            uint32_t ts;
+            uint32_t gateway;
+            uint8_t port;
+            uint8_t ttl;
+            uint8_t valid;
+            uint8_t pad;
+        };
+
+        SharedFlowTable();
+        ~SharedFlowTable();
+
+        int open(const String &name, uint32_t size, uint32_t hash_type, ErrorHandler *);
+        void close();
+
+        uint32_t size() const { return _header->size; }
+        uint32_t capacity() const { return _header->nbuckets * WAYS; }
+        uint32_t bucket_count() const { return _header->nbuckets; }
+
+        bool contains(const Key &);
+        bool remove(const Key &);
+        bool get(const Key &, uint8_t &port, uint32_t &gateway);
+        bool check(const Key &, uint32_t now, uint32_t timeout, int ttl,
+                   uint8_t &port, uint32_t &gateway);
+        int insert(const Key &, uint32_t ts, uint32_t gateway, uint8_t port, uint8_t ttl,
+                   bool overwrite, uint32_t timeout, bool loop_avoidance);
+
+        template <typename F> int remove_if(F predicate);
+        template <typename F> void for_each(F function);
+
+        static inline bool is_expired(uint32_t now, uint32_t ts, uint32_t timeout)
+        {
+            int32_t diff = now - ts;
+            return diff < 0 || (uint32_t) diff > timeout;
+        }
+
+    private:
+
+        enum { MAGIC = 0x46465431, VERSION = 1, RECOVER_SPINS = 0x10000 };
+
+        struct Header
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t nbuckets;
+            uint32_t hash_type;
+            volatile uint32_t size;
+            uint8_t pad[44];
+        };
+
+        struct Bucket
+        {
+            volatile uint32_t lock;
+            uint32_t pad;
+            Entry e[WAYS];
+            uint8_t pad2[128 - 8 - WAYS * sizeof(Entry)];
+        };
+
+        String _name;
+        uint32_t _pid;
+        void *_base;
+        size_t _length;
+        Header *_header;
+        Bucket *_buckets;
+
+        inline Bucket *bucket(const Key &key) const
+        {
+            return &_buckets[key.hash & (_header->nbuckets - 1)];
+        }
+
+        static inline bool key_eq(const Key &a, const Key &b)
+        {
+            return a.sa == b.sa && a.da == b.da && a.sp == b.sp && a.dp == b.dp
+                && a.hash == b.hash;
+        }
+
+        int attach(uint32_t nbuckets, uint32_t hash_type, ErrorHandler *);
+        void remove_stale(int fd);
+        static bool owner_dead(uint32_t pid);
+        void recover(Bucket *, uint32_t owner);
+
+        // Owner is checked only after spinning for a while, so a live
+        // process holding the lock is not slowed down
+        inline void lock(Bucket *b)
+        {
+            for (uint32_t spins = 1; !__sync_bool_compare_and_swap(&b->lock, 0, _pid); spins++)
+            {
+                uint32_t owner = b->lock;
+
+                if (owner && !(spins % RECOVER_SPINS) && owner_dead(owner)
+                    && __sync_bool_compare_and_swap(&b->lock, owner, _pid))
+                {
+                    recover(b, owner);
+                    return;
+                }
+#if defined(__x86_64__) || defined(__i386__)
+                __builtin_ia32_pause();
+#else
+                click_compiler_fence();
+#endif
+            }
+        }
+
+        static inline void unlock(Bucket *b)
+        {
+            __sync_lock_release(&b->lock);
+        }
+
+        inline Entry *find(Bucket *b, const Key &key)
+        {
+            for (int i = 0; i < WAYS; i++)
+                if (b->e[i].valid && key_eq(b->e[i].key, key))
+                    return &b->e[i];
+            return NULL;
+        }
+};
+
+template <typename F> int
+SharedFlowTable::remove_if(F predicate)
+{
+    int removed = 0;
+
+    for (uint32_t i = 0; i < _header->nbuckets; i++)
+    {
+        Bucket *b = &_buckets[i];
+        lock(b);
+        for (int j = 0; j < WAYS; j++)
+            if (b->e[j].valid && predicate((const Entry &) b->e[j]))
+            {
+                b->e[j].valid = 0;
+                removed++;
+            }
+        unlock(b);
+    }
+
+    __sync_fetch_and_sub(&_header->size, removed);
+    return removed;
+}
+
+template <typename F> void
+SharedFlowTable::for_each(F function)
+{
+    for (uint32_t i = 0; i < _header->nbuckets; i++)
+    {
+        Bucket *b = &_buckets[i];
+        Entry e[WAYS];
+
+        lock(b);
+        memcpy(e, b->e, sizeof(e));
+        unlock(b);
+
+        for (int j = 0; j < WAYS; j++)
+            if (e[j].valid)
+                function((const Entry &) e[j]);
+    }
+}
+
+CLICK_ENDDECLS
+#endif
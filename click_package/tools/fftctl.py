@@ -0,0 +1,113 @@
+#!/usr/bin/python3 -B
+
+# Bulk flow programming client for FFTControl element.
+#
+# Reads flow records, one per line, and sends them in batches to the Unix
+# socket of FFTControl, waiting for the result of each batch:
+#
+#   add SRC DST SPORT DPORT GATEWAY PORT [ttl TTL] [proto PROTO]
+#   modify SRC DST SPORT DPORT GATEWAY PORT [ttl TTL] [proto PROTO]
+#   remove SRC DST SPORT DPORT [proto PROTO]
+#
+# 'add' does not replace active entries, 'modify' does. TTL 0 (default)
+# matches TTL of the first packet of the flow. Controllers can import this
+# module and use pack_record() and Client directly.
+
+import os
+import sys
+import socket
+import struct
+import argparse
+import tempfile
+
+MAGIC = 0x46465443
+VERSION = 1
+OPS = {'add': 1, 'modify': 2, 'remove': 3}
+HEADER = struct.Struct('!IHHI')
+RECORD = struct.Struct('!BBBB4s4sHH4s')
+REPLY = struct.Struct('!IHHIi')
+MAX_RECORDS = (65536 - HEADER.size) // RECORD.size
+
+
+def pack_record(op, src, dst, sport, dport, gateway='0.0.0.0', port=0, ttl=0, proto=0):
+    return RECORD.pack(OPS[op], port, ttl, proto, socket.inet_aton(src), socket.inet_aton(dst),
+                       sport, dport, socket.inet_aton(gateway))
+
+
+def parse_line(line):
+    words = line.split()
+    opts = {}
+    while len(words) > 2 and words[-2] in ('ttl', 'proto'):
+        opts[words[-2]] = int(words[-1])
+        words = words[:-2]
+    op = words[0]
+    if op not in OPS or len(words) != (5 if op == 'remove' else 7):
+        raise ValueError('bad record: %s' % line.strip())
+    args = words[1:3] + [int(words[3]), int(words[4])]
+    if op != 'remove':
+        args += [words[5], int(words[6])]
+    return pack_record(op, *args, **opts)
+
+
+class Client(object):
+
+    def __init__(self, path, timeout=5.0):
+        self.path = path
+        self.seq = 0
+        # Socket must be bound to receive replies
+        self.local = os.path.join(tempfile.gettempdir(), 'fftctl.%d' % os.getpid())
+        self.s = socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM)
+        if os.path.exists(self.local):
+            os.unlink(self.local)
+        self.s.bind(self.local)
+        self.s.settimeout(timeout)
+
+    def close(self):
+        self.s.close()
+        os.unlink(self.local)
+
+    def send(self, records):
+        """Sends one batch of packed records, returns the number of applied
+        records or -1 if the batch was rejected."""
+
+        self.seq += 1
+        self.s.sendto(HEADER.pack(MAGIC, VERSION, len(records), self.seq) + b''.join(records), self.path)
+        while True:
+            magic, _, _, seq, result = REPLY.unpack(self.s.recv(REPLY.size))
+            if magic == MAGIC and seq == self.seq:
+                return result
+
+
+if __name__ == '__main__':
+
+    parser = argparse.ArgumentParser(description='Send flow records to FFTControl.')
+    parser.add_argument('--socket', '-s', help='path of FFTControl socket')
+    parser.add_argument('--batch', '-b', help='records per batch (default = %d)' % MAX_RECORDS, type=int, default=MAX_RECORDS)
+    parser.add_argument('--raw', help='write records to stdout in the format of FFT bulk handler instead', action='store_true')
+    parser.add_argument('file', help='file with records (default = stdin)', nargs='?', type=argparse.FileType('r'), default=sys.stdin)
+    opt = parser.parse_args()
+
+    if not opt.raw and not opt.socket:
+        parser.error('either --socket or --raw is required')
+    if not 0 < opt.batch <= MAX_RECORDS:
+        parser.error('batch must be between 1 and %d' % MAX_RECORDS)
+
+    records = [parse_line(line) for line in opt.file if line.strip() and not line.startswith('#')]
+
+    if opt.raw:
+        sys.stdout.buffer.write(b''.join(records))
+        sys.exit(0)
+
+    client = Client(opt.socket)
+    applied = 0
+    try:
+        for i in range(0, len(records), opt.batch):
+            result = client.send(records[i:i + opt.batch])
+            if result < 0:
+                sys.stderr.write('batch starting at record %d rejected\n' % i)
+                sys.exit(1)
+            applied += result
+    finally:
+        client.close()
+
+    print('%d records, %d applied' % (len(records), applied))
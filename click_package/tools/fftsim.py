@@ -0,0 +1,269 @@
+#!/usr/bin/python3 -B
+
+# Offline FFT sizing and timeout simulator.
+#
+# Replays a packet trace through the FFT element of a userlevel Click build
+# (CheckFFT on every packet, AddFFT on misses) for each point of a sweep of
+# TIMEOUT, GC_ON_ADD and GC_ON_CHECK values. Packets are replayed as fast as
+# possible, while expiration follows packet timestamps of the trace. Points
+# run in parallel, one Click process each.
+
+import os
+import sys
+import csv
+import time
+import struct
+import argparse
+import itertools
+import tempfile
+import subprocess
+import concurrent.futures
+
+
+CONFIG = """
+require(famtar);
+
+src :: %(source)s;
+fft :: FFT(TIMEOUT %(timeout)s, GC_ON_ADD %(gc_on_add)d, GC_ON_CHECK %(gc_on_check)d%(fft_args)s);
+
+src -> total :: Counter
+-> cnt :: Counter(COUNT_CALL %(sample)d sample.run)
+-> chk :: CheckFFT(fft);
+
+chk[0] -> miss :: Counter -> AddFFT(fft, 0) -> Discard;
+chk[1] -> hit :: Counter -> Discard;
+
+sample :: Script(TYPE PASSIVE,
+                 print "sample $(total.count) $(fft.size)",
+                 write cnt.reset);
+
+DriverManager(wait_stop,
+              print "sample $(total.count) $(fft.size)",
+              print "result packets $(total.count)",
+              print "result hits $(hit.count)",
+              print "result misses $(miss.count)",
+              print "result repinned $(fft.repinned)",
+              print "result deferred $(fft.deferred)",
+              print "result size $(fft.size)",
+              print "arena $(fft.arena)",
+%(latency)s              stop);
+"""
+
+LATENCY = """              print "latency $(fft.latency)",
+"""
+
+SOURCES = {
+    'pcap': 'FromDump("%s", STOP true, TIMING false, FORCE_IP true)',
+    'ipsum': 'FromIPSummaryDump("%s", STOP true, TIMING false)',
+}
+
+
+def pcap_times(path, sample):
+    """Returns timestamps of the first and of every sample-th IPv4 packet
+    of a pcap file, counted like FromDump with FORCE_IP does."""
+
+    times = []
+
+    with open(path, 'rb') as f:
+        header = f.read(24)
+        magic = header[:4]
+        if magic in (b'\xd4\xc3\xb2\xa1', b'\x4d\x3c\xb2\xa1'):
+            endian = '<'
+        elif magic in (b'\xa1\xb2\xc3\xd4', b'\xa1\xb2\x3c\x4d'):
+            endian = '>'
+        else:
+            raise ValueError('%s: not a pcap file (pcapng is not supported)' % path)
+        nsec = magic in (b'\x4d\x3c\xb2\xa1', b'\xa1\xb2\x3c\x4d')
+        linktype = struct.unpack(endian + 'I', header[20:24])[0] & 0xFFFF
+        record = struct.Struct(endian + 'IIII')
+        count = 0
+
+        while True:
+            rh = f.read(16)
+            if len(rh) < 16:
+                break
+            sec, frac, caplen, _ = record.unpack(rh)
+            data = f.read(caplen)
+
+            if linktype == 1:
+                ethertype = data[12:14]
+                if ethertype == b'\x81\x00':
+                    ethertype = data[16:18]
+                ip = ethertype == b'\x08\x00'
+            elif linktype == 113:
+                ip = data[14:16] == b'\x08\x00'
+            elif linktype in (12, 14, 101):
+                ip = len(data) > 0 and data[0] >> 4 == 4
+            elif linktype == 0:
+                ip = len(data) >= 4 and data[:4] in (b'\x02\x00\x00\x00', b'\x00\x00\x00\x02')
+            else:
+                raise ValueError('%s: unsupported link type %d' % (path, linktype))
+
+            if ip:
+                if count % sample == 0:
+                    times.append(sec + frac / (1e9 if nsec else 1e6))
+                count += 1
+
+    return times
+
+
+def ipsum_times(path, sample):
+    """Returns timestamps of the first and of every sample-th packet of an
+    IP summary dump."""
+
+    times = []
+    column = 0
+    count = 0
+
+    with open(path) as f:
+        for line in f:
+            if line.startswith('!data'):
+                fields = line.split()[1:]
+                column = fields.index('timestamp') if 'timestamp' in fields else -1
+                continue
+            if not line.strip() or line[0] in '!#':
+                continue
+            if count % sample == 0 and column >= 0:
+                times.append(float(line.split()[column]))
+            count += 1
+
+    return times
+
+
+def run_point(opt, point):
+    timeout, gc_on_add, gc_on_check = point
+    config = CONFIG % {
+        'source': SOURCES[opt.format] % opt.trace,
+        'timeout': timeout,
+        'gc_on_add': gc_on_add,
+        'gc_on_check': gc_on_check,
+        'fft_args': ', ' + opt.fft_args if opt.fft_args else '',
+        'sample': opt.sample,
+        'latency': LATENCY if opt.latency else '',
+    }
+
+    # Child is reaped with wait4() to get its CPU time, so output is not
+    # read with communicate()
+    with tempfile.TemporaryFile() as err:
+        start = time.time()
+        p = subprocess.Popen([opt.click, '-e', config], stdout=subprocess.PIPE, stderr=err)
+        out = p.stdout.read().decode()
+        _, status, usage = os.wait4(p.pid, 0)
+        p.returncode = status
+        wall = time.time() - start
+        err.seek(0)
+        errors = err.read().decode()
+
+    if status != 0:
+        raise RuntimeError('click failed for %s:\n%s' % (label(point), errors))
+
+    result = parse_output(out)
+    result['cpu'] = usage.ru_utime + usage.ru_stime
+    result['wall'] = wall
+    return result
+
+
+def parse_output(out):
+    """Parses output of the DriverManager and sample scripts. Multi-line
+    handler values (arena, latency) follow their marker word."""
+
+    result = {'samples': [], 'latency': []}
+    block = None
+
+    for line in out.splitlines():
+        words = line.split()
+        if not words:
+            continue
+        if words[0] == 'sample':
+            result['samples'].append((int(words[1]), int(words[2])))
+        elif words[0] == 'result':
+            result[words[1]] = int(words[2])
+        elif words[0] in ('arena', 'latency'):
+            block = words[0]
+            words = words[1:]
+        if block == 'arena' and len(words) == 2 and words[0] == 'bytes':
+            result['arena_bytes'] = int(words[1])
+        elif block == 'latency' and len(words) == 6:
+            result['latency'].append(' '.join(words))
+
+    return result
+
+
+def label(point):
+    return 'timeout=%s gc_on_add=%d gc_on_check=%d' % point
+
+
+def write_timeline(opt, point, result, times):
+    name = 'fftsim_%s_%d_%d.csv' % point
+    with open(os.path.join(opt.outdir, name), 'w') as f:
+        writer = csv.writer(f)
+        writer.writerow(['packets', 'trace_time', 'size'])
+        for packets, size in result['samples']:
+            i = packets // opt.sample
+            ts = '%.6f' % (times[i] - times[0]) if i < len(times) else ''
+            writer.writerow([packets, ts, size])
+
+
+if __name__ == '__main__':
+
+    parser = argparse.ArgumentParser(description='Replay a trace through FFT for a sweep of parameters.')
+    parser.add_argument('trace', help='pcap file or IP summary dump (text flow trace)')
+    parser.add_argument('--format', '-f', help='trace format: pcap or ipsum (default = pcap)', choices=sorted(SOURCES), default='pcap')
+    parser.add_argument('--click', help='userlevel click binary with the famtar package (default = click)', default='click')
+    parser.add_argument('--timeout', '-t', help='comma separated TIMEOUT values (default = 1s,2s,5s,10s,30s)', default='1s,2s,5s,10s,30s')
+    parser.add_argument('--gc-on-add', help='comma separated GC_ON_ADD values (default = 0,1)', default='0,1')
+    parser.add_argument('--gc-on-check', help='comma separated GC_ON_CHECK values (default = 0,1)', default='0,1')
+    parser.add_argument('--fft-args', help='additional FFT arguments, for example "KEY 5tuple, HOT_SIZE 16384"', default='')
+    parser.add_argument('--sample', '-s', help='table size is sampled every N packets (default = 100000)', type=int, default=100000)
+    parser.add_argument('--jobs', '-j', help='parallel Click processes (default = number of CPUs)', type=int, default=os.cpu_count())
+    parser.add_argument('--outdir', '-o', help='directory for per point table size timelines in CSV (default = none)')
+    parser.add_argument('--latency', help='print operation latencies, requires FFT_LATENCY_STATS build', action='store_true')
+    opt = parser.parse_args()
+
+    if opt.sample <= 0:
+        parser.error('sample must be positive')
+
+    points = list(itertools.product(opt.timeout.split(','),
+                                    [int(v) for v in opt.gc_on_add.split(',')],
+                                    [int(v) for v in opt.gc_on_check.split(',')]))
+
+    times = []
+    if opt.outdir:
+        os.makedirs(opt.outdir, exist_ok=True)
+        times = pcap_times(opt.trace, opt.sample) if opt.format == 'pcap' else ipsum_times(opt.trace, opt.sample)
+
+    results = {}
+    with concurrent.futures.ThreadPoolExecutor(max_workers=max(1, opt.jobs)) as executor:
+        futures = dict((executor.submit(run_point, opt, point), point) for point in points)
+        for future in concurrent.futures.as_completed(futures):
+            point = futures[future]
+            try:
+                results[point] = future.result()
+            except Exception as e:
+                sys.stderr.write('%s\n' % e)
+                continue
+            sys.stderr.write('done %s in %.1f s\n' % (label(point), results[point]['wall']))
+            if opt.outdir:
+                write_timeline(opt, point, results[point], times)
+
+    # Peak memory is the size of the entry arena, which does not shrink, GC
+    # cost shows as CPU time differences between otherwise equal points
+    print('%-8s %6s %8s %12s %9s %12s %12s %12s %14s %9s %11s' % (
+        'timeout', 'gc_add', 'gc_check', 'packets', 'hit_ratio', 'repinned', 'peak_size',
+        'final_size', 'peak_mem_B', 'cpu_s', 'Mpps'))
+
+    for point in points:
+        r = results.get(point)
+        if r is None:
+            continue
+        packets = r.get('packets', 0)
+        peak = max([size for _, size in r['samples']] + [r.get('size', 0)])
+        print('%-8s %6d %8d %12d %9.4f %12d %12d %12d %14d %9.2f %11.3f' % (
+            point[0], point[1], point[2], packets,
+            float(r.get('hits', 0)) / packets if packets else 0.0,
+            r.get('repinned', 0), peak, r.get('size', 0), r.get('arena_bytes', 0),
+            r['cpu'], packets / r['cpu'] / 1e6 if r['cpu'] else 0.0))
+        if r['latency']:
+            print('  latency (op samples p50 p99 p99.9 max cycles):')
+            for line in r['latency']:
+                print('    ' + line)
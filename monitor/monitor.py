@@ -8,6 +8,8 @@ import logging
 import signal
 import subprocess
 import socket
+import mmap
+import struct
 
 import sdnroute.linkinfo
 import sdnroute.utils
@@ -143,6 +145,70 @@ class Quagga(object):
             self.cmds = []
 
 
+class ShmCounterStats(object):
+    """Reads byte counters published by CounterPage element in shared
+    memory, without a round trip into the router process."""
+
+    MAGIC = 0x46434E54
+    VERSION = 2
+    HEADER = struct.Struct('=IIIIIIQ32x')
+    HEADER_SEQ = 16
+    SLOT = struct.Struct('=IIQQ16s24x')
+    SLOT_SEQ = 0
+    SEQ = struct.Struct('=I')
+
+    def __init__(self, name):
+        path = '/dev/shm/' + name.lstrip('/')
+        with open(path, 'rb') as f:
+            self.page = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, version, nports, interval = self.HEADER.unpack_from(self.page, 0)[:4]
+        if magic != self.MAGIC or version != self.VERSION:
+            raise ValueError('%s is not an initialized counter page' % path)
+        self.has_fft = interval != 0
+        # Each thread has its own block of slots, one per port
+        self.nthreads = self.HEADER.unpack_from(self.page, 0)[5]
+        self.block = nports * self.SLOT.size
+        self.slots = {}
+        for i in range(nports):
+            offset = self.HEADER.size + i * self.SLOT.size
+            label = self.SLOT.unpack_from(self.page, offset)[4]
+            self.slots[label.rstrip(b'\0').decode()] = offset
+
+    def read(self, offset, struct_, seq_offset):
+        # Seqlock: read is repeated while a writer is active or if the
+        # sequence number (at SEQ_OFFSET in the struct) changed during
+        # the read
+        while True:
+            seq = self.SEQ.unpack_from(self.page, offset + seq_offset)[0]
+            if seq & 1:
+                continue
+            values = struct_.unpack_from(self.page, offset)
+            if self.SEQ.unpack_from(self.page, offset + seq_offset)[0] == seq:
+                return values
+
+    def get_counters(self, name, direction):
+        """Returns packets and bytes of port labeled NAME.DIRECTION or NAME,
+        summed over the slots of all threads."""
+        offset = self.slots.get('%s.%s' % (name, direction), self.slots.get(name))
+        if offset is None:
+            raise KeyError('no counter page slot for %s' % name)
+        packets = bytes_ = 0
+        for t in range(self.nthreads):
+            values = self.read(offset + t * self.block, self.SLOT, self.SLOT_SEQ)
+            packets += values[2]
+            bytes_ += values[3]
+        return packets, bytes_
+
+    def get_bytes(self, name, direction):
+        return name, self.get_counters(name, direction)[1]
+
+    def fft_size(self):
+        """Returns the number of FFT entries, or None if the page has none."""
+        if not self.has_fft:
+            return None
+        return self.read(0, self.HEADER, self.HEADER_SEQ)[6]
+
+
 CTRLS = {
     'xorp': Xorpsh,
     'quagga': Quagga
@@ -242,6 +308,11 @@ def iterate_all_interfaces():
         ifs[name]['last_counter'] = counter
         ifs[name]['last_time'] = now
 
+    if shm_stats:
+        fft_size = shm_stats.fft_size()
+        if fft_size is not None:
+            logger.debug('FFT size: %s' % "{:,d}".format(fft_size))
+
     ctrl.flush()
 
 if __name__ == '__main__':
@@ -260,6 +331,7 @@ if __name__ == '__main__':
     parser.add_argument("--interval", "-i", help="counters read interval in ms (default = 200)", type=int, default=200)
     parser.add_argument("--ewm-alpha", "-s", help="exponential moving average (default = 0.2)", type=float, default=0.2)
     parser.add_argument("--cfgdir", "-d", help="cfg dir (default = None)", default='')
+    parser.add_argument("--shm", help="read counters from CounterPage shared memory page instead of handler files (default = None)", default='')
     parser.add_argument('--verbose', '-v', help="set verbose level (-v, -vv)", action='count')
     parser.add_argument('--log', type=argparse.FileType('w'))
     parser.add_argument('interfaces', metavar='iface', nargs='+', help='interfaces to monitor')
@@ -288,11 +360,12 @@ if __name__ == '__main__':
     signal.signal(signal.SIGTERM, signal_handler)
 
     ifs = {}
+    shm_stats = ShmCounterStats(opt.shm) if opt.shm else None
 
     for if_name in opt.interfaces:
 
         ifs[if_name] = {
-            'stats_reader': sdnroute.linkinfo.ClickCounterFileStats(path=opt.cfgdir),
+            'stats_reader': shm_stats or sdnroute.linkinfo.ClickCounterFileStats(path=opt.cfgdir),
             'ctrl': None,
             'file_speed_sys': "/sys/class/net/%s/speed" % if_name,
             'file_speed_cfg': opt.cfgdir + "/speed/" + if_name,